@@ -39,6 +39,7 @@ CSyncFolder::CSyncFolder(const QString &alias,
 
 CSyncFolder::~CSyncFolder()
 {
+    delete _csync;
 }
 
 bool CSyncFolder::isBusy() const
@@ -52,16 +53,25 @@ void CSyncFolder::startSync(const QStringList &pathList)
         qCritical() << "* ERROR csync is still running and new sync requested.";
         return;
     }
-    delete _csync;
     _errors.clear();
     _csyncError = false;
 
-    _csync = new CSyncThread( path(), secondPath() );
-    connect(_csync, SIGNAL(started()), SLOT(slotCSyncStarted()));
-    connect(_csync, SIGNAL(finished()), SLOT(slotCSyncFinished()));
-    connect(_csync, SIGNAL(csyncError(QString)), SLOT(slotCSyncError(QString)));
+    // the thread keeps its csync session between runs
+    if( !_csync ) {
+        _csync = new CSyncThread( path(), secondPath() );
+        connect(_csync, SIGNAL(started()), SLOT(slotCSyncStarted()));
+        connect(_csync, SIGNAL(finished()), SLOT(slotCSyncFinished()));
+        connect(_csync, SIGNAL(csyncError(QString)), SLOT(slotCSyncError(QString)));
+    }
+    _csync->startSync( pathList );
+}
 
-    _csync->start();
+bool CSyncFolder::cancelSync()
+{
+    if( !_csync || !_csync->isRunning() )
+        return false;
+    _csync->requestCancel();
+    return true;
 }
 
 void CSyncFolder::slotCSyncStarted()
@@ -73,10 +83,16 @@ void CSyncFolder::slotCSyncStarted()
 void CSyncFolder::slotCSyncFinished()
 {
     SyncResult res(SyncResult::Success);
-    if( _csyncError ) {
+    if( _csync->wasCancelled() ) {
+        // nothing was changed, the sync runs again later
+        res.setStatus( SyncResult::NotYetStarted );
+    } else if( _csyncError ) {
         res.setStatus( SyncResult::Error );
         res.setErrorString( _errors.join("\\n"));
     }
+    res.setProfile( _csync->profile() );
+    qDebug() << "    * csync job waited" << _csync->queueTime()
+             << "msec for a worker and ran" << _csync->runTime() << "msec";
     emit syncFinished( res );
 }
 
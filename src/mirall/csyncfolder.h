@@ -35,6 +35,7 @@ public:
                 const QString &secondPath, QObject *parent = 0L);
     virtual ~CSyncFolder();
     virtual void startSync(const QStringList &pathList);
+    virtual bool cancelSync();
     virtual bool isBusy() const;
 protected slots:
     void slotCSyncStarted();
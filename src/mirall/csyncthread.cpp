@@ -15,22 +15,55 @@
 
 #include <QDebug>
 #include <QDir>
+#include <QFileInfo>
 #include <QMutexLocker>
-#include <QThread>
 #include <QStringList>
 #include <QTextStream>
 #include <QTime>
 #include <QDebug>
 
+#ifndef Q_OS_WIN
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "mirall/csyncthread.h"
 #include "mirall/mirallconfigfile.h"
 
 namespace Mirall {
 
+// states of _cancelRequested, past the last cancellation
+// point a request is refused.
+enum { CancelNone = 0, CancelRequested = 1, CancelTooLate = 2 };
+
 /* static variables to hold the credentials */
 QString CSyncThread::_user;
 QString CSyncThread::_passwd;
 QMutex CSyncThread::_mutex;
+QMutex CSyncThread::_initMutex;
+
+/*
+ * True if the mode csync read for the directory lets the user of
+ * the walk create and remove entries in it. That is only known for
+ * a directory the user owns, its owner bits are the owner entry of
+ * an ACL as well. For any other owner the group and other bits do
+ * not tell, group membership or ACL entries decide, so false asks
+ * for the check on the file system.
+ */
+static bool modeAllowsWrite( const TREE_WALK_FILE* file, const WalkStats* wStats )
+{
+#ifdef Q_OS_WIN
+    // the mode is made up on windows
+    Q_UNUSED( file );
+    Q_UNUSED( wStats );
+    return false;
+#else
+    if( (ulong) file->uid != wStats->uid ) {
+        return false;
+    }
+    return ( file->mode & (S_IWUSR | S_IXUSR) ) == (S_IWUSR | S_IXUSR);
+#endif
+}
 
  int CSyncThread::checkPermissions( TREE_WALK_FILE* file, void *data )
  {
@@ -43,6 +76,10 @@ QMutex CSyncThread::_mutex;
 
      wStats->seenFiles++;
 
+     if( wStats->cancelled && wStats->cancelled->fetchAndAddRelaxed(0) ) {
+         return -1;
+     }
+
      switch(file->instruction) {
      case CSYNC_INSTRUCTION_NONE:
 
@@ -82,14 +119,20 @@ QMutex CSyncThread::_mutex;
          break;
      }
 
-     if( file ) {
-         QString source(wStats->sourcePath);
-         source.append(file->path);
-         QFileInfo fi(source);
-
-         if( fi.isDir()) {  // File type directory.
-            if( !(fi.isWritable() && fi.isExecutable()) ) {
-                 wStats->errorType = WALK_ERROR_DIR_PERMS;
+     // only directories need to be writable. csync stat'ed every
+     // entry already, its mode answers for most of them. Ignored
+     // files are not synced, their permissions do not matter.
+     if( file->type == CSYNC_FTW_TYPE_DIR && file->instruction != CSYNC_INSTRUCTION_IGNORE
+         && !modeAllowsWrite( file, wStats ) ) {
+         const QString path = QString::fromLocal8Bit(file->path);
+         if( !(wStats->excludes && wStats->excludes->isExcluded(path)) ) {
+             QFileInfo fi(wStats->sourcePath + path);
+             wStats->dirChecks++;
+
+             if( fi.isDir()) {  // File type directory.
+                 if( !(fi.isWritable() && fi.isExecutable()) ) {
+                     wStats->errorType = WALK_ERROR_DIR_PERMS;
+                 }
              }
          }
      }
@@ -106,71 +149,134 @@ CSyncThread::CSyncThread(const QString &source, const QString &target, bool loca
     : _source(source)
     , _target(target)
     , _localCheckOnly( localCheckOnly )
+    , _csync( 0 )
+    , _sessionRuns( 0 )
+    , _cancelRequested( 0 )
+    , _cancelled( false )
 
 {
     _mutex.lock();
     if( ! _source.endsWith('/')) _source.append('/');
     _mutex.unlock();
+
+    qRegisterMetaType<WalkStats>("WalkStats");
+
+    // the same compiled list the folder watcher uses
+    refreshExcludes();
 }
 
 CSyncThread::~CSyncThread()
 {
+    // the session belongs to the run, a queued one never starts
+    // and a running one stops at its next cancellation point.
+    SyncExecutor::instance()->remove( this );
+    if( isRunning() ) {
+        qDebug() << "## Waiting for the CSync run of" << _source << "to stop";
+        requestCancel();
+        QTime t;
+        t.start();
+        SyncExecutor::instance()->wait( this );
+        qDebug() << "## CSync run of" << _source << "stopped after" << t.elapsed() << "msec";
+    }
+    SyncExecutor::instance()->wait( this );
+    closeSession();
+}
 
+void CSyncThread::startSync( const QStringList& paths )
+{
+    if( isRunning() ) {
+        qDebug() << "## CSync run of" << _source << "still busy";
+        return;
+    }
+    setSyncPaths( paths );
+    _cancelRequested.fetchAndStoreOrdered( CancelNone );
+    _cancelled = false;
+    SyncExecutor::instance()->enqueue( this );
 }
 
-void CSyncThread::run()
+bool CSyncThread::isRunning() const
 {
-    CSYNC *csync;
+    return SyncExecutor::instance()->isBusy( const_cast<CSyncThread*>( this ) );
+}
 
-    WalkStats *wStats = new WalkStats;
-    QTime walkTime;
+void CSyncThread::done()
+{
+    // the job can be queued again from here on
+    emit finished();
+}
+
+QString CSyncThread::source() const
+{
+    return _source;
+}
+
+QString CSyncThread::target() const
+{
+    return _target;
+}
 
-    wStats->sourcePath = 0;
-    wStats->errorType  = 0;
-    wStats->eval       = 0;
-    wStats->removed    = 0;
-    wStats->renamed    = 0;
-    wStats->newFiles   = 0;
-    wStats->ignores    = 0;
-    wStats->sync       = 0;
-    wStats->seenFiles  = 0;
-    wStats->conflicts  = 0;
-    wStats->error      = 0;
+bool CSyncThread::localCheckOnly() const
+{
+    return _localCheckOnly;
+}
+
+bool CSyncThread::refreshExcludes()
+{
+    MirallConfigFile cfg;
+    const QString file = cfg.excludeFile();
+    const QDateTime modified = QFileInfo( file ).lastModified();
 
+    if( file == _excludes.fileName() && modified == _excludesModified )
+        return false;
+
+    _excludes.clear();
+    _excludes.loadFile( file );
+    _excludesModified = modified;
+    return true;
+}
+
+bool CSyncThread::openSession()
+{
+    if( _csync )
+        return true;
+
+    QTime t;
+    t.start();
     _mutex.lock();
-    if( csync_create(&csync,
-                          _source.toLocal8Bit().data(),
-                          _target.toLocal8Bit().data()) < 0 ) {
+    if( csync_create(&_csync,
+                     _source.toLocal8Bit().data(),
+                     _target.toLocal8Bit().data()) < 0 ) {
+        _mutex.unlock();
+        _csync = 0;
+        _profile.setTime( SyncProfile::CreatePhase, t.elapsed() );
+        _profile.addError( SyncProfile::CreatePhase );
         emit csyncError( tr("CSync create failed.") );
+        return false;
     }
-    // FIXME: Check if we really need this stringcopy!
-    wStats->sourcePath = qstrdup( _source.toLocal8Bit().constData() );
     _mutex.unlock();
+    _profile.setTime( SyncProfile::CreatePhase, t.restart() );
 
-    qDebug() << "## CSync Thread local only: " << _localCheckOnly;
-    csync_set_auth_callback( csync, getauth );
-    csync_enable_conflictcopys(csync);
+    csync_set_auth_callback( _csync, getauth );
+    csync_enable_conflictcopys(_csync);
 
-
-    MirallConfigFile cfg;
-    QString excludeList = cfg.excludeFile();
+    QString excludeList = _excludes.fileName();
 
     if( !excludeList.isEmpty() ) {
         qDebug() << "==== added CSync exclude List: " << excludeList.toAscii();
-        csync_add_exclude_list( csync, excludeList.toAscii() );
+        csync_add_exclude_list( _csync, excludeList.toAscii() );
     }
 
-    QTime t;
-    t.start();
-
     _mutex.lock();
     if( _localCheckOnly ) {
-        csync_set_local_only( csync, true );
+        csync_set_local_only( _csync, true );
     }
     _mutex.unlock();
 
-    if( csync_init(csync) < 0 ) {
+    t.restart();
+    QMutexLocker initLocker( &_initMutex );
+    if( csync_init(_csync) < 0 ) {
         CSYNC_ERROR_CODE err = csync_errno();
+        initLocker.unlock();
         QString errStr;
 
         switch( err ) {
@@ -197,67 +303,275 @@ void CSyncThread::run()
             errStr = tr("An internal error number %1 happend.").arg( (int) err );
         }
         qDebug() << " #### ERROR String emitted: " << errStr;
+        _profile.setTime( SyncProfile::InitPhase, t.elapsed() );
+        _profile.addError( SyncProfile::InitPhase );
         emit csyncError(errStr);
+        closeSession();
+        return false;
+    }
+    initLocker.unlock();
+    _profile.setTime( SyncProfile::InitPhase, t.elapsed() );
+    qDebug() << "## CSync session of" << _source << "opened in"
+             << _profile.time( SyncProfile::CreatePhase ) + _profile.time( SyncProfile::InitPhase ) << "msec";
+    _sessionRuns = 0;
+    return true;
+}
+
+void CSyncThread::closeSession()
+{
+    if( !_csync )
+        return;
+    // writes the state db and releases the lock
+    csync_destroy(_csync);
+    _csync = 0;
+    qDebug() << "## CSync session of" << _source << "closed after" << _sessionRuns << "runs";
+}
+
+void CSyncThread::setSyncPaths( const QStringList& paths )
+{
+    QStringList relative;
+    foreach( const QString& path, paths ) {
+        if( path == _source || path + QLatin1Char('/') == _source ) {
+            // the whole folder
+            relative.clear();
+            break;
+        }
+        if( path.startsWith( _source ) ) {
+            relative.append( path.mid( _source.length() ) );
+        } else {
+            qDebug() << "## Sync path outside of" << _source << ":" << path;
+        }
+    }
+
+    // a path below another one is covered by it
+    relative.sort();
+    _scope.clear();
+    foreach( const QString& path, relative ) {
+        if( !_scope.isEmpty() && inScope( _scope, path ) )
+            continue;
+        _scope.append( path );
+    }
+}
+
+QStringList CSyncThread::syncPaths() const
+{
+    QStringList paths;
+    foreach( const QString& path, _scope ) {
+        paths.append( _source + path );
+    }
+    return paths;
+}
+
+bool CSyncThread::requestCancel()
+{
+    return _cancelRequested.testAndSetOrdered( CancelNone, CancelRequested )
+        || _cancelRequested.fetchAndAddOrdered(0) == CancelRequested;
+}
+
+bool CSyncThread::wasCancelled() const
+{
+    return _cancelled;
+}
+
+SyncProfile CSyncThread::profile() const
+{
+    return _profile;
+}
+
+bool CSyncThread::inScope( const QStringList &scope, const QString &path )
+{
+    if( scope.isEmpty() )
+        return true;
+    // path or one of its parent folders has to be in the scope.
+    // The closest path sorting before it is not enough, "a/b-c"
+    // sorts between "a/b" and "a/b/c".
+    int end = path.length();
+    while( end > 0 ) {
+        if( qBinaryFind( scope.constBegin(), scope.constEnd(), path.left( end ) ) != scope.constEnd() )
+            return true;
+        end = path.lastIndexOf( QLatin1Char('/'), end - 1 );
+    }
+    return false;
+}
+
+void CSyncThread::execute()
+{
+    emit started();
+
+    WalkStats wStats;
+    QTime walkTime;
+    QTime phase;
+    bool reusable = false;
+
+    wStats.excludes   = &_excludes;
+    wStats.cancelled  = &_cancelRequested;
+    wStats.errorType  = 0;
+    wStats.eval       = 0;
+    wStats.removed    = 0;
+    wStats.renamed    = 0;
+    wStats.newFiles   = 0;
+    wStats.ignores    = 0;
+    wStats.sync       = 0;
+    wStats.seenFiles  = 0;
+    wStats.conflicts  = 0;
+    wStats.error      = 0;
+    wStats.dirChecks  = 0;
+#ifdef Q_OS_WIN
+    wStats.uid        = 0;
+#else
+    wStats.uid        = geteuid();
+#endif
+
+    _mutex.lock();
+    wStats.sourcePath = _source;
+    _mutex.unlock();
+
+    qDebug() << "## CSync Thread local only: " << _localCheckOnly;
+    // csync can not be scoped, it always syncs the whole folder
+    if( _scope.isEmpty() ) {
+        qDebug() << "## Syncing all of" << _source;
+    } else {
+        qDebug() << "## Syncing all of" << _source << "for" << _scope.size() << "changed paths";
+    }
+
+    QTime t;
+    t.start();
+    _profile = SyncProfile();
+
+    // csync reads the exclude list in csync_init only, a changed
+    // list needs a new session.
+    if( refreshExcludes() ) {
+        qDebug() << "## Exclude list changed, reopening the CSync session";
+        closeSession();
+    }
+    if( _csync ) {
+        qDebug() << "## Reusing the CSync session of" << _source << ", run" << _sessionRuns + 1;
+    }
+    if( !openSession() ) {
         goto cleanup;
     }
+    _sessionRuns++;
+
+    // the phases below are the points a run can stop at,
+    // nothing is changed before the propagation.
+    if( _cancelRequested.fetchAndAddOrdered(0) ) {
+        goto cancelled;
+    }
 
     qDebug() << "############################################################### >>";
-    if( csync_update(csync) < 0 ) {
+    // csync updates the local and the remote tree in one go
+    phase.start();
+    if( csync_update(_csync) < 0 ) {
+        _profile.setTime( SyncProfile::UpdatePhase, phase.elapsed() );
+        _profile.addError( SyncProfile::UpdatePhase );
         emit csyncError(tr("CSync Update failed."));
         goto cleanup;
     }
+    _profile.setTime( SyncProfile::UpdatePhase, phase.elapsed() );
     qDebug() << "<<###############################################################";
+    if( _cancelRequested.fetchAndAddOrdered(0) ) {
+        goto cancelled;
+    }
 
-    csync_set_userdata(csync, wStats);
+    csync_set_userdata(_csync, &wStats);
 
     walkTime.start();
-    if( csync_walk_local_tree(csync, &checkPermissions, 0) < 0 ) {
+    if( csync_walk_local_tree(_csync, &checkPermissions, 0) < 0 ) {
+        csync_set_userdata(_csync, 0);
+        _profile.setTime( SyncProfile::WalkPhase, walkTime.elapsed() );
+        _profile.setFiles( SyncProfile::WalkPhase, wStats.seenFiles );
+        if( _cancelRequested.fetchAndAddOrdered(0) ) {
+            goto cancelled;
+        }
         qDebug() << "Error in treewalk.";
-        if( wStats->errorType == WALK_ERROR_DIR_PERMS ) {
+        if( wStats.errorType == WALK_ERROR_DIR_PERMS ) {
             emit csyncError(tr("The local filesystem has directories which are write protected.\n"
                                "That prevents ownCloud from successful syncing.\n"
                                "Please make sure that all directories are writeable."));
-        } else if( wStats->errorType == WALK_ERROR_WALK ) {
+        } else if( wStats.errorType == WALK_ERROR_WALK ) {
             emit csyncError(tr("CSync encountered an error while examining the file system.\n"
                                "Syncing is not possible."));
-        } else if( wStats->errorType == WALK_ERROR_INSTRUCTIONS ) {
+        } else if( wStats.errorType == WALK_ERROR_INSTRUCTIONS ) {
             emit csyncError(tr("CSync update generated a strange instruction.\n"
                                "Please write a bug report."));
         }
         emit csyncError(tr("Local filesystem problems. Better disable Syncing and check."));
+        _profile.addError( SyncProfile::WalkPhase );
         goto cleanup;
     }
-    qDebug() << " ..... Local walk finished: " << walkTime.elapsed();
-
-    // emit the treewalk results. Do not touch the wStats after this.
+    csync_set_userdata(_csync, 0);
+    _profile.setTime( SyncProfile::WalkPhase, walkTime.elapsed() );
+    // the local tree update produced
+    _profile.setFiles( SyncProfile::UpdatePhase, wStats.seenFiles );
+    _profile.setFiles( SyncProfile::WalkPhase, wStats.seenFiles );
+    // the files with an instruction, reconcile settles them
+    _profile.setFiles( SyncProfile::ReconcilePhase, wStats.eval + wStats.removed + wStats.renamed
+                       + wStats.newFiles + wStats.conflicts + wStats.sync );
+    qDebug() << " ..... Local walk finished: " << walkTime.elapsed() << "msec,"
+             << wStats.seenFiles << "files,"
+             << wStats.dirChecks << "folders checked on disk";
+
+    // the stats are copied to the receivers
+    wStats.excludes  = 0;
+    wStats.cancelled = 0;
     emit treeWalkResult(wStats);
 
     _mutex.lock();
     if( _localCheckOnly ) {
         _mutex.unlock();
         // we have to go out here as its local check only.
+        reusable = true;
         goto cleanup;
     } else {
         _mutex.unlock();
         // check if we can write all over.
 
-        if( csync_reconcile(csync) < 0 ) {
+        phase.start();
+        if( csync_reconcile(_csync) < 0 ) {
+            _profile.setTime( SyncProfile::ReconcilePhase, phase.elapsed() );
+            _profile.addError( SyncProfile::ReconcilePhase );
             emit csyncError(tr("CSync reconcile failed."));
             goto cleanup;
         }
-        if( csync_propagate(csync) < 0 ) {
+        _profile.setTime( SyncProfile::ReconcilePhase, phase.elapsed() );
+        // the last point to stop at, later requests are refused
+        if( !_cancelRequested.testAndSetOrdered( CancelNone, CancelTooLate ) ) {
+            goto cancelled;
+        }
+        phase.start();
+        if( csync_propagate(_csync) < 0 ) {
+            _profile.setTime( SyncProfile::PropagatePhase, phase.elapsed() );
+            _profile.addError( SyncProfile::PropagatePhase );
             emit csyncError(tr("CSync propagate failed."));
             goto cleanup;
         }
+        _profile.setTime( SyncProfile::PropagatePhase, phase.elapsed() );
     }
+    reusable = true;
+    goto cleanup;
+cancelled:
+    qDebug() << "## CSync run of" << _source << "cancelled";
+    _cancelled = true;
+    // nothing was propagated, the journal is unchanged
+    reusable = true;
 cleanup:
-    csync_destroy(csync);
-    /*
-     * Attention: do not delete the wStat memory here. it is deleted in the
-     * slot catching the signel treeWalkResult because this thread can faster
-     * die than the slot has read out the data.
-     */
-    qDebug() << "CSync run took " << t.elapsed() << " Milliseconds";
+#ifdef HAVE_CSYNC_COMMIT
+    // writes the journal and drops the trees of this run, the
+    // state db stays loaded for the next one. A context which
+    // failed is in an unknown state and is not reused.
+    if( _csync && reusable && csync_commit(_csync) < 0 ) {
+        qDebug() << "## CSync commit failed";
+        reusable = false;
+    }
+    if( !reusable ) {
+        closeSession();
+    }
+#else
+    // this csync can not run a context twice
+    Q_UNUSED( reusable );
+    closeSession();
+#endif
+    qDebug() << "CSync run took " << t.elapsed() << " Milliseconds:" << _profile.toString();
 }
 
 
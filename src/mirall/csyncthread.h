@@ -18,12 +18,20 @@
 
 #include <stdint.h>
 
+#include <QAtomicInt>
+#include <QDateTime>
+#include <QMetaType>
 #include <QMutex>
-#include <QThread>
+#include <QObject>
 #include <QString>
+#include <QStringList>
 
 #include <csync.h>
 
+#include "mirall/excludematcher.h"
+#include "mirall/syncexecutor.h"
+#include "mirall/syncprofile.h"
+
 class QProcess;
 
 namespace Mirall {
@@ -36,7 +44,12 @@ enum walkErrorTypes {
 };
 
 struct walkStats_s {
-    const char *sourcePath;
+    QString sourcePath;
+    // the pointers are only set during the walk, the stats
+    // handed out by treeWalkResult() do not have them.
+    const ExcludeMatcher *excludes;
+    // set when the run is to stop, the walk is aborted
+    const QAtomicInt *cancelled;
     int errorType;
 
     ulong eval;
@@ -49,24 +62,83 @@ struct walkStats_s {
     ulong error;
 
     ulong seenFiles;
+    // directories whose mode bits did not tell if they are
+    // writable, they were checked on the file system
+    ulong dirChecks;
+    // the effective user of the walk
+    ulong uid;
 };
 
 typedef walkStats_s WalkStats;
 
-class CSyncThread : public QThread
+/**
+ * The csync session of a folder
+ *
+ * Every sync is a job on the SyncExecutor, the object lives as
+ * long as its folder and is queued again for the next sync.
+ * The signals are emitted on the worker thread.
+ */
+class CSyncThread : public QObject, public SyncJob
 {
     Q_OBJECT
 public:
     CSyncThread(const QString &source, const QString &target, bool = false);
     ~CSyncThread();
 
-    virtual void run();
+    virtual void execute();
+    virtual void done();
+
+    /**
+     * Queues a run about the given paths, see setSyncPaths().
+     */
+    void startSync( const QStringList& );
+
+    /**
+     * True while the run is queued or busy
+     */
+    bool isRunning() const;
+
+    /**
+     * The absolute paths the run is about. csync can not be
+     * scoped, every run updates, reconciles and propagates the
+     * whole folder, the paths only show up in the log. Paths
+     * below another one are dropped, without paths or with the
+     * source folder among them the run is about everything.
+     */
+    void setSyncPaths( const QStringList& );
+    QStringList syncPaths() const;
+
+    QString source() const;
+    QString target() const;
+    bool localCheckOnly() const;
+
+    /**
+     * Asks the running sync to stop. It stops between the
+     * phases of csync and during the tree walk. Returns false
+     * once the propagation started, the run goes to its end.
+     */
+    bool requestCancel();
+
+    /**
+     * True if the run stopped because of requestCancel(),
+     * nothing was propagated then.
+     */
+    bool wasCancelled() const;
+
+    /**
+     * Timings and counters of the phases of the last run
+     */
+    SyncProfile profile() const;
 
     static void setUserPwd( const QString&, const QString& );
     static int checkPermissions( TREE_WALK_FILE* file, void *data);
+    // true if path, relative to the source, is in scope
+    static bool inScope( const QStringList &scope, const QString &path );
 
 signals:
-    void treeWalkResult(WalkStats*);
+    void started();
+    void finished();
+    void treeWalkResult(const WalkStats&);
     void csyncError(const QString&);
 
 private:
@@ -78,14 +150,38 @@ private:
                 void *userdata
     );
 
+    bool openSession();
+    void closeSession();
+    // reloads the exclude list if its file changed since the
+    // last run, true if it did
+    bool refreshExcludes();
+
     static QMutex _mutex;
+    // csync_errno() has no context, the error of a csync_init()
+    // is only the one of this session while it is held. Not
+    // _mutex, getauth() takes that one during the init.
+    static QMutex _initMutex;
     static QString _user;
     static QString _passwd;
 
     QString _source;
     QString _target;
     bool    _localCheckOnly;
+    ExcludeMatcher _excludes;
+    QDateTime _excludesModified;
+    // the csync context kept between runs, only used by
+    // execute() and the destructor
+    CSYNC *_csync;
+    int _sessionRuns;
+    // relative to _source, sorted, none below another one
+    QStringList _scope;
+    // CancelNone, CancelRequested or CancelTooLate
+    QAtomicInt _cancelRequested;
+    bool _cancelled;
+    SyncProfile _profile;
 };
 }
 
+Q_DECLARE_METATYPE(Mirall::WalkStats)
+
 #endif // CSYNCTHREAD_H
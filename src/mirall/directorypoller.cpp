@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) by Duncan Mac-Vicar P. <duncan@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+
+#include <sys/stat.h>
+
+#include "mirall/directorypoller.h"
+#include "mirall/excludematcher.h"
+#include "mirall/fileutils.h"
+
+namespace Mirall
+{
+
+namespace {
+
+// splits a directory listing into files and sub directories
+class ListingVisitor : public FileUtils::ScanVisitor
+{
+public:
+    ListingVisitor(const ExcludeMatcher *excludes)
+        : _excludes(excludes) {}
+
+    bool visit(const QString &dir, const char *rawName,
+               FileUtils::EntryType type, const struct stat *)
+    {
+        const QString name = QFile::decodeName(rawName);
+        if (type == FileUtils::DirEntry) {
+            // hidden folders are ignored, like the watcher does
+            if (rawName[0] == '.')
+                return false;
+            if (!_excludes || !_excludes->isExcluded(dir + QLatin1Char('/') + name, name))
+                dirs.insert(name);
+        } else {
+            files.insert(name);
+        }
+        return false;
+    }
+
+    QSet<QString> files;
+    QSet<QString> dirs;
+
+private:
+    const ExcludeMatcher *_excludes;
+};
+
+}
+
+DirectoryPoller::DirectoryPoller(const QString &root)
+    : _root(root),
+      _excludes(0),
+      _primed(false),
+      _listings(0),
+      _lastPassListings(0),
+      _lastPassTime(-1)
+{
+}
+
+void DirectoryPoller::setExcludeMatcher(const ExcludeMatcher *excludes)
+{
+    _excludes = excludes;
+}
+
+bool DirectoryPoller::poll(QStringList *changed, int budget)
+{
+    if (_passQueue.isEmpty()) {
+        if (_dirs.isEmpty()) {
+            DirState root;
+            root.mtime = -1;
+            root.listedAt = 0;
+            _dirs.insert(_root, root);
+        }
+        // sorted, parents are checked before their children
+        _passQueue = _dirs.keys();
+        _passQueue.sort();
+        _listings = 0;
+        _passTimer.start();
+    }
+
+    QTime slice;
+    slice.start();
+    while (!_passQueue.isEmpty() && slice.elapsed() < budget) {
+        check(_passQueue.takeFirst(), changed);
+    }
+    if (!_passQueue.isEmpty())
+        return false;
+
+    if (!_primed) {
+        qDebug() << "* Poller snapshot of" << _root << "has" << _dirs.size() << "folders";
+    }
+    _primed = true;
+    _lastPassListings = _listings;
+    _lastPassTime = _passTimer.elapsed();
+    return true;
+}
+
+void DirectoryPoller::check(const QString &dir, QStringList *changed)
+{
+    if (!_dirs.contains(dir)) {
+        // dropped with its parent during this pass
+        return;
+    }
+
+    struct stat st;
+    if (::stat(QFile::encodeName(dir).constData(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        // the listing of the parent reports it
+        forget(dir);
+        return;
+    }
+
+    const DirState old = _dirs.value(dir);
+    const qint64 mtime = qint64(st.st_mtime);
+    // the mtime has a resolution of a second, a listing taken
+    // in the same second as the last change can miss a change
+    // which followed within that second.
+    if (mtime == old.mtime && mtime < old.listedAt)
+        return;
+
+    ListingVisitor visitor(_excludes);
+    FileUtils::scanDirectory(dir, &visitor);
+    _listings++;
+
+    const QString prefix = dir + QLatin1Char('/');
+    foreach (const QString &name, visitor.files) {
+        if (_primed && !old.files.contains(name))
+            changed->append(prefix + name);
+    }
+    foreach (const QString &name, old.files) {
+        if (_primed && !visitor.files.contains(name))
+            changed->append(prefix + name);
+    }
+    foreach (const QString &name, old.dirs) {
+        if (visitor.dirs.contains(name))
+            continue;
+        if (_primed)
+            changed->append(prefix + name);
+        forget(prefix + name);
+    }
+    foreach (const QString &name, visitor.dirs) {
+        if (old.dirs.contains(name))
+            continue;
+        if (_primed)
+            changed->append(prefix + name);
+        // listed later in this pass, everything in it
+        // is new as well.
+        DirState state;
+        state.mtime = -1;
+        state.listedAt = 0;
+        _dirs.insert(prefix + name, state);
+        _passQueue.append(prefix + name);
+    }
+
+    DirState &state = _dirs[dir];
+    state.mtime = mtime;
+    state.listedAt = QDateTime::currentMSecsSinceEpoch() / 1000;
+    state.files = visitor.files;
+    state.dirs = visitor.dirs;
+}
+
+void DirectoryPoller::forget(const QString &dir)
+{
+    QHash<QString, DirState>::iterator it = _dirs.find(dir);
+    if (it == _dirs.end())
+        return;
+
+    const QSet<QString> subdirs = it.value().dirs;
+    _dirs.erase(it);
+    foreach (const QString &name, subdirs)
+        forget(dir + QLatin1Char('/') + name);
+}
+
+bool DirectoryPoller::isPrimed() const
+{
+    return _primed;
+}
+
+QStringList DirectoryPoller::directories() const
+{
+    return _dirs.keys();
+}
+
+int DirectoryPoller::directoryCount() const
+{
+    return _dirs.size();
+}
+
+int DirectoryPoller::lastPassListings() const
+{
+    return _lastPassListings;
+}
+
+int DirectoryPoller::lastPassTime() const
+{
+    return _lastPassTime;
+}
+
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) by Duncan Mac-Vicar P. <duncan@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef MIRALL_DIRECTORYPOLLER_H
+#define MIRALL_DIRECTORYPOLLER_H
+
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QTime>
+
+namespace Mirall
+{
+
+class ExcludeMatcher;
+
+/**
+ * Finds changes below a folder without kernel notifications
+ *
+ * Keeps a snapshot of the mtime and the entries of every
+ * directory. A pass stats each known directory once and only
+ * lists the ones whose mtime changed, the new listing is
+ * compared with the snapshot to find added and removed entries.
+ *
+ * Files changed in place do not touch the mtime of their
+ * directory and are not noticed, the regular full sync of the
+ * folder takes care of them.
+ */
+class DirectoryPoller
+{
+public:
+    explicit DirectoryPoller(const QString &root);
+
+    /**
+     * Directories matching the patterns are not looked into
+     */
+    void setExcludeMatcher(const ExcludeMatcher *excludes);
+
+    /**
+     * Continues the current pass for at most budget msecs and
+     * appends the changed paths to changed. Returns true if the
+     * pass is complete, the next call starts a new one.
+     *
+     * The first pass only takes the snapshot and reports nothing.
+     */
+    bool poll(QStringList *changed, int budget);
+
+    /**
+     * True once the first pass completed
+     */
+    bool isPrimed() const;
+
+    QStringList directories() const;
+    int directoryCount() const;
+
+    /**
+     * Directories listed during the last complete pass, and
+     * the msecs the pass took.
+     */
+    int lastPassListings() const;
+    int lastPassTime() const;
+
+private:
+    struct DirState {
+        qint64 mtime;
+        // seconds since epoch when the entries were read
+        qint64 listedAt;
+        QSet<QString> files;
+        QSet<QString> dirs;
+    };
+
+    void check(const QString &dir, QStringList *changed);
+    void forget(const QString &dir);
+
+    QString _root;
+    const ExcludeMatcher *_excludes;
+    QHash<QString, DirState> _dirs;
+    QStringList _passQueue;
+    bool _primed;
+    int _listings;
+    int _lastPassListings;
+    int _lastPassTime;
+    QTime _passTimer;
+};
+
+}
+
+#endif
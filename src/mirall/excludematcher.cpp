@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) by Duncan Mac-Vicar P. <duncan@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include <QDebug>
+#include <QFile>
+
+#include "mirall/excludematcher.h"
+
+namespace Mirall
+{
+
+static bool isWildcard(QChar c)
+{
+    return c == QLatin1Char('*') || c == QLatin1Char('?') || c == QLatin1Char('[');
+}
+
+// index of the first wildcard character at or after from, -1 if none
+static int nextWildcard(const QString &str, int from)
+{
+    for (int i = from; i < str.length(); ++i) {
+        if (isWildcard(str.at(i)))
+            return i;
+    }
+    return -1;
+}
+
+ExcludeMatcher::ExcludeMatcher()
+    : _patternCount(0)
+{
+    clear();
+}
+
+void ExcludeMatcher::clear()
+{
+    _fileName.clear();
+    _patternCount = 0;
+    _literals.clear();
+    _wildcards.clear();
+    // node 0 is the root of each trie
+    _suffixes.clear();
+    _suffixes.append(TrieNode());
+    _prefixes.clear();
+    _prefixes.append(TrieNode());
+}
+
+bool ExcludeMatcher::loadFile(const QString &file)
+{
+    if( file.isEmpty() ) return false;
+
+    QFile infile( file );
+    if (!infile.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+
+    while (!infile.atEnd()) {
+        QString line = QString::fromLocal8Bit( infile.readLine() ).trimmed();
+        if( !line.startsWith( '#' )) {
+            addPattern(line);
+        }
+    }
+    _fileName = file;
+    qDebug() << "* Compiled" << _patternCount << "exclude patterns from" << file;
+    return true;
+}
+
+void ExcludeMatcher::addPattern(const QString &pattern)
+{
+    if( pattern.isEmpty() ) return;
+    _patternCount++;
+
+    int first = nextWildcard(pattern, 0);
+    if (first == -1) {
+        _literals.insert(pattern);
+        return;
+    }
+
+    const int last = pattern.length() - 1;
+    if (first == 0 && pattern.at(0) == QLatin1Char('*') && nextWildcard(pattern, 1) == -1) {
+        // "*suffix", a lone "*" matches everything
+        insert(_suffixes, pattern.mid(1), true);
+        return;
+    }
+    if (first == last && pattern.at(last) == QLatin1Char('*')) {
+        // "prefix*"
+        insert(_prefixes, pattern.left(last), false);
+        return;
+    }
+
+    QRegExp regexp(pattern);
+    regexp.setPatternSyntax(QRegExp::Wildcard);
+    _wildcards.append(regexp);
+}
+
+void ExcludeMatcher::insert(QVector<TrieNode> &trie, const QString &str, bool reverse)
+{
+    int node = 0;
+    const int len = str.length();
+    for (int i = 0; i < len; ++i) {
+        const ushort c = str.at(reverse ? len - 1 - i : i).unicode();
+        int child = trie[node].next.value(c, 0);
+        if (child == 0) {
+            child = trie.size();
+            trie[node].next.insert(c, child);
+            trie.append(TrieNode());
+        }
+        node = child;
+    }
+    trie[node].terminal = true;
+}
+
+bool ExcludeMatcher::matchSuffix(const QString &str) const
+{
+    int node = 0;
+    for (int i = str.length() - 1; ; --i) {
+        if (_suffixes.at(node).terminal)
+            return true;
+        if (i < 0)
+            return false;
+        node = _suffixes.at(node).next.value(str.at(i).unicode(), 0);
+        if (node == 0)
+            return false;
+    }
+}
+
+bool ExcludeMatcher::matchPrefix(const QString &str) const
+{
+    int node = 0;
+    for (int i = 0; ; ++i) {
+        if (_prefixes.at(node).terminal)
+            return true;
+        if (i >= str.length())
+            return false;
+        node = _prefixes.at(node).next.value(str.at(i).unicode(), 0);
+        if (node == 0)
+            return false;
+    }
+}
+
+bool ExcludeMatcher::isExcluded(const QString &path) const
+{
+    int slash = path.lastIndexOf(QLatin1Char('/'));
+    if (slash == path.length() - 1 && slash > 0) {
+        // trailing slash, take the last real component
+        return isExcluded(path.left(slash));
+    }
+    return isExcluded(path, path.mid(slash + 1));
+}
+
+bool ExcludeMatcher::isExcluded(const QString &path, const QString &fileName) const
+{
+    if (_patternCount == 0)
+        return false;
+
+    if (_literals.contains(fileName) || _literals.contains(path))
+        return true;
+    // the wildcard can span directories, so checking the
+    // full path covers the file name as well.
+    if (matchSuffix(path))
+        return true;
+    if (matchPrefix(fileName) || matchPrefix(path))
+        return true;
+
+    for (int i = 0; i < _wildcards.size(); ++i) {
+        QRegExp &regexp = _wildcards[i];
+        if (regexp.exactMatch(fileName) || regexp.exactMatch(path))
+            return true;
+    }
+    return false;
+}
+
+int ExcludeMatcher::patternCount() const
+{
+    return _patternCount;
+}
+
+QString ExcludeMatcher::fileName() const
+{
+    return _fileName;
+}
+
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) by Duncan Mac-Vicar P. <duncan@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef MIRALL_EXCLUDEMATCHER_H
+#define MIRALL_EXCLUDEMATCHER_H
+
+#include <QHash>
+#include <QList>
+#include <QRegExp>
+#include <QSet>
+#include <QString>
+#include <QVector>
+
+namespace Mirall
+{
+
+/**
+ * Matches paths against the patterns of an exclude list
+ *
+ * The patterns are compiled once when they are added. A path
+ * is excluded if a pattern matches either its file name or the
+ * full path, the same rule csync applies to the exclude list.
+ *
+ * Literal patterns end up in a hash, "*suffix" and "prefix*"
+ * patterns in character tries, only the remaining wildcard
+ * patterns are matched with a regular expression.
+ *
+ * Matching does not touch the file system.
+ */
+class ExcludeMatcher
+{
+public:
+    ExcludeMatcher();
+
+    /**
+     * Loads the patterns of an exclude file, one per line.
+     * Empty lines and lines starting with # are skipped.
+     */
+    bool loadFile(const QString &file);
+
+    /**
+     * Adds a single wildcard pattern
+     */
+    void addPattern(const QString &pattern);
+
+    /**
+     * Removes all patterns
+     */
+    void clear();
+
+    /**
+     * True if the path or its file name matches a pattern
+     */
+    bool isExcluded(const QString &path) const;
+
+    /**
+     * Same as isExcluded(path) if the file name is already known
+     */
+    bool isExcluded(const QString &path, const QString &fileName) const;
+
+    /**
+     * Number of patterns added so far
+     */
+    int patternCount() const;
+
+    /**
+     * The file the patterns were loaded from, if any
+     */
+    QString fileName() const;
+
+private:
+    struct TrieNode {
+        TrieNode() : terminal(false) {}
+        QHash<ushort, int> next;
+        bool terminal;
+    };
+
+    void insert(QVector<TrieNode> &trie, const QString &str, bool reverse);
+    bool matchSuffix(const QString &str) const;
+    bool matchPrefix(const QString &str) const;
+
+    QString _fileName;
+    int _patternCount;
+    QSet<QString> _literals;
+    QVector<TrieNode> _suffixes;
+    QVector<TrieNode> _prefixes;
+    // QRegExp::exactMatch() modifies the match state
+    mutable QList<QRegExp> _wildcards;
+};
+
+}
+
+#endif
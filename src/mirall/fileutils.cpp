@@ -13,30 +13,285 @@
  */
 #include "mirall/fileutils.h"
 
+#include <QAtomicInt>
 #include <QDir>
+#include <QDirIterator>
 #include <QFile>
 #include <QFileInfo>
 #include <QFileInfoList>
+#include <QList>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
+
+#include <sys/stat.h>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Buffer size for reading directory entries
+#define SCAN_BUFFERSIZE 32768
 
 namespace Mirall
 {
 
-QStringList FileUtils::subFoldersList(QString folder,
-                                      SubFolderListOptions options)
+namespace {
+
+class SubFolderCollector : public FileUtils::ScanVisitor
+{
+public:
+    bool visit(const QString &dir, const char *name,
+               FileUtils::EntryType type, const struct stat *)
+    {
+        // hidden folders are not listed nor descended into
+        if (type != FileUtils::DirEntry || name[0] == '.')
+            return false;
+        list.append(dir + QLatin1Char('/') + QFile::decodeName(name));
+        return true;
+    }
+
+    QStringList list;
+};
+
+class RemoveVisitor : public FileUtils::ScanVisitor
 {
-    QDir dir(folder);
-    dir.setFilter(QDir::Dirs | QDir::NoDotAndDotDot);
+public:
+    RemoveVisitor() : result(true) {}
+
+    bool visit(const QString &dir, const char *name,
+               FileUtils::EntryType type, const struct stat *)
+    {
+        const QString path = dir + QLatin1Char('/') + QFile::decodeName(name);
+        if (type == FileUtils::DirEntry) {
+            subdirs.append(path);
+        } else if (!QFile::remove(path)) {
+            result = false;
+        }
+        return false;
+    }
+
+    QStringList subdirs;
+    bool result;
+};
 
-    QFileInfoList list = dir.entryInfoList();
-    QStringList dirList;
+#ifdef Q_OS_LINUX
 
-    for (int i = 0; i < list.size(); ++i) {
-        QFileInfo fileInfo = list.at(i);
-        dirList << fileInfo.absoluteFilePath();
-        if (options & SubFolderRecursive )
-            dirList << subFoldersList(fileInfo.absoluteFilePath(), options);
+// the kernel's record, glibc only declares it in newer versions
+struct linux_dirent64 {
+    quint64        d_ino;
+    qint64         d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[1];
+};
+
+FileUtils::EntryType entryType(unsigned char d_type)
+{
+    switch (d_type) {
+    case DT_UNKNOWN: return FileUtils::UnknownEntry;
+    case DT_DIR:     return FileUtils::DirEntry;
+    case DT_REG:     return FileUtils::FileEntry;
+    case DT_LNK:     return FileUtils::SymLinkEntry;
+    default:         return FileUtils::OtherEntry;
     }
-    return dirList;
+}
+
+FileUtils::EntryType entryType(const struct stat &st)
+{
+    if (S_ISDIR(st.st_mode)) return FileUtils::DirEntry;
+    if (S_ISREG(st.st_mode)) return FileUtils::FileEntry;
+    if (S_ISLNK(st.st_mode)) return FileUtils::SymLinkEntry;
+    return FileUtils::OtherEntry;
+}
+
+/*
+ * Reads the open directory fd, dir is its path. The names of the
+ * subdirectories the visitor accepted are appended to subdirs,
+ * only the directories are held in memory, not the files.
+ */
+bool readDirectory(int fd, const QString &dir, FileUtils::ScanVisitor *visitor,
+                   FileUtils::ScanOptions options, QList<QByteArray> *subdirs)
+{
+    // aligned for the records
+    qint64 buffer[SCAN_BUFFERSIZE / sizeof(qint64)];
+    char *buf = reinterpret_cast<char *>(buffer);
+
+    while (true) {
+        long len = syscall(SYS_getdents64, fd, buf, sizeof(buffer));
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        if (len == 0)
+            return true;
+
+        for (long pos = 0; pos < len; ) {
+            const struct linux_dirent64 *d = reinterpret_cast<struct linux_dirent64 *>(buf + pos);
+            pos += d->d_reclen;
+
+            const char *name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                continue;
+
+            FileUtils::EntryType type = entryType(d->d_type);
+            struct stat st;
+            const struct stat *stp = 0;
+            if ((options & FileUtils::ScanStat) || type == FileUtils::UnknownEntry) {
+                if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+                    type = entryType(st);
+                    if (options & FileUtils::ScanStat)
+                        stp = &st;
+                }
+            }
+
+            const bool descend = visitor->visit(dir, name, type, stp);
+            if (descend && type == FileUtils::DirEntry && subdirs)
+                subdirs->append(QByteArray(name));
+        }
+    }
+}
+
+// scans fd and, depth first, everything below it. Closes fd.
+bool scanTree(int fd, const QString &dir, FileUtils::ScanVisitor *visitor,
+              FileUtils::ScanOptions options)
+{
+    QList<QByteArray> subdirs;
+    bool ok = readDirectory(fd, dir, visitor, options,
+                            (options & FileUtils::ScanRecursive) ? &subdirs : 0);
+
+    foreach (const QByteArray &name, subdirs) {
+        int child = openat(fd, name.constData(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (child < 0) {
+            ok = false;
+            continue;
+        }
+        if (!scanTree(child, dir + QLatin1Char('/') + QFile::decodeName(name), visitor, options))
+            ok = false;
+    }
+    close(fd);
+    return ok;
+}
+
+// a pool of its own, jobs of other users can not hold up a scan
+Q_GLOBAL_STATIC(QThreadPool, scanPool)
+
+// scans one top level subtree in the scan pool
+class ScanJob : public QRunnable
+{
+public:
+    ScanJob(int fd, const QString &dir, FileUtils::ScanVisitor *visitor,
+            FileUtils::ScanOptions options, QSemaphore *done, QAtomicInt *failed)
+        : _fd(fd), _dir(dir), _visitor(visitor), _options(options),
+          _done(done), _failed(failed)
+    {
+    }
+
+    void run()
+    {
+        if (!scanTree(_fd, _dir, _visitor, _options))
+            _failed->fetchAndStoreRelaxed(1);
+        _done->release();
+    }
+
+private:
+    int _fd;
+    QString _dir;
+    FileUtils::ScanVisitor *_visitor;
+    FileUtils::ScanOptions _options;
+    QSemaphore *_done;
+    QAtomicInt *_failed;
+};
+
+bool scanParallel(int fd, const QString &dir, FileUtils::ScanVisitor *visitor,
+                  FileUtils::ScanOptions options)
+{
+    QList<QByteArray> subdirs;
+    bool ok = readDirectory(fd, dir, visitor, options, &subdirs);
+
+    QSemaphore done;
+    QAtomicInt failed(0);
+    int jobs = 0;
+    foreach (const QByteArray &name, subdirs) {
+        int child = openat(fd, name.constData(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (child < 0) {
+            ok = false;
+            continue;
+        }
+        ScanJob *job = new ScanJob(child, dir + QLatin1Char('/') + QFile::decodeName(name),
+                                   visitor, options, &done, &failed);
+        // without a free thread the subtree is scanned right here,
+        // waiting for a thread which might never come could deadlock.
+        if (!scanPool()->tryStart(job)) {
+            job->run();
+            delete job;
+        }
+        jobs++;
+    }
+    done.acquire(jobs);
+    close(fd);
+    return ok && failed == 0;
+}
+
+#endif // Q_OS_LINUX
+
+} // anon namespace
+
+bool FileUtils::scanDirectory(const QString &path, ScanVisitor *visitor, ScanOptions options)
+{
+    QString dir(path);
+    while (dir.length() > 1 && dir.endsWith(QLatin1Char('/')))
+        dir.chop(1);
+
+#ifdef Q_OS_LINUX
+    int fd = open(QFile::encodeName(dir).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    if ((options & ScanParallel) && (options & ScanRecursive))
+        return scanParallel(fd, dir, visitor, options);
+    return scanTree(fd, dir, visitor, options);
+#else
+    // portable fallback, QFileInfo stats every entry
+    QDirIterator it(dir, QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System);
+    QStringList subdirs;
+    while (it.hasNext()) {
+        it.next();
+        const QFileInfo info = it.fileInfo();
+        EntryType type = OtherEntry;
+        if (info.isSymLink())
+            type = SymLinkEntry;
+        else if (info.isDir())
+            type = DirEntry;
+        else if (info.isFile())
+            type = FileEntry;
+
+        const QByteArray name = QFile::encodeName(info.fileName());
+        if (visitor->visit(dir, name.constData(), type, 0) && type == DirEntry)
+            subdirs.append(info.absoluteFilePath());
+    }
+    bool ok = true;
+    if (options & ScanRecursive) {
+        foreach (const QString &subdir, subdirs) {
+            if (!scanDirectory(subdir, visitor, options))
+                ok = false;
+        }
+    }
+    return ok;
+#endif
+}
+
+QStringList FileUtils::subFoldersList(QString folder,
+                                      SubFolderListOptions options)
+{
+    SubFolderCollector collector;
+    scanDirectory(folder, &collector,
+                  (options & SubFolderRecursive) ? ScanRecursive : ScanNoOptions);
+    return collector.list;
 }
 
 /*
@@ -66,17 +321,20 @@ bool FileUtils::removeDir(const QString &path)
     QDir dir(path);
 
     if (dir.exists(path)) {
-        Q_FOREACH(QFileInfo info, dir.entryInfoList(QDir::NoDotAndDotDot | QDir::System | QDir::Hidden  | QDir::AllDirs | QDir::Files, QDir::DirsFirst)) {
-            if (info.isDir()) {
-                result = removeDir(info.absoluteFilePath());
-            }
-            else {
-                result = QFile::remove(info.absoluteFilePath());
-            }
+        // files are removed while streaming, symbolic links
+        // are removed, never followed.
+        RemoveVisitor visitor;
+        scanDirectory(path, &visitor);
+        result = visitor.result;
 
+        foreach (const QString &subdir, visitor.subdirs) {
             if (!result) {
                 return result;
             }
+            result = removeDir(subdir);
+        }
+        if (!result) {
+            return result;
         }
         result = dir.rmdir(path);
     }
@@ -17,6 +17,8 @@
 
 #include <QStringList>
 
+struct stat;
+
 namespace Mirall
 {
 
@@ -29,12 +31,66 @@ public:
     };
     Q_DECLARE_FLAGS(SubFolderListOptions, SubFolderListOption)
 
+    enum EntryType {
+        UnknownEntry,
+        FileEntry,
+        DirEntry,
+        SymLinkEntry,
+        OtherEntry
+    };
+
+    enum ScanOption {
+        ScanNoOptions = 0x0,
+        // descend into the directories the visitor accepts
+        ScanRecursive = 0x1,
+        // stat every entry and pass the result to the visitor
+        ScanStat      = 0x2,
+        // scan the subtrees of the top level directories in
+        // the global thread pool, the visitor must be thread safe
+        ScanParallel  = 0x4
+    };
+    Q_DECLARE_FLAGS(ScanOptions, ScanOption)
+
+    /**
+     * Receives the entries found by scanDirectory()
+     */
+    class ScanVisitor
+    {
+    public:
+        virtual ~ScanVisitor() {}
+
+        /**
+         * Called for every entry of dir except . and .., name is
+         * in the local 8 bit encoding, see QFile::decodeName().
+         * st is only set when scanning with ScanStat.
+         *
+         * For directories, the return value decides whether a
+         * recursive scan descends into it. Symbolic links are
+         * never followed.
+         */
+        virtual bool visit(const QString &dir, const char *name,
+                           EntryType type, const struct stat *st) = 0;
+    };
+
+    /**
+     * Streams the entries of path to the visitor without
+     * building a list. On Linux the directories are read with
+     * getdents64() on directory descriptors and nothing is
+     * stat'ed unless ScanStat is given or the file system does
+     * not tell the entry type.
+     *
+     * Returns false if a directory could not be read.
+     */
+    static bool scanDirectory(const QString &path, ScanVisitor *visitor,
+                              ScanOptions options = ScanNoOptions);
+
     static QStringList subFoldersList(QString folder,
                                       SubFolderListOptions options = SubFolderNoOptions );
     static bool removeDir(const QString &path);
 };
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(FileUtils::SubFolderListOptions)
+Q_DECLARE_OPERATORS_FOR_FLAGS(FileUtils::ScanOptions)
 
 }
 
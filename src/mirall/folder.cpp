@@ -13,15 +13,22 @@
  */
 
 #include <QDebug>
+#include <QFile>
+#include <QTextStream>
 #include <QTimer>
 #include <QUrl>
 
 #include "mirall/folder.h"
 #include "mirall/folderwatcher.h"
 #include "mirall/mirallconfigfile.h"
+#include "mirall/syncqueue.h"
 #include "mirall/syncresult.h"
 
 #define DEFAULT_POLL_INTERVAL_SEC 15000
+// the watcher interval backs off on errors up to this
+#define MAX_WATCHER_INTERVAL_MSEC 60000
+// sync profiles kept per folder
+#define PROFILE_HISTORY_SIZE 20
 
 namespace Mirall {
 
@@ -35,7 +42,15 @@ Folder::Folder(const QString &alias, const QString &path, const QString& secondP
       _onlyOnlineEnabled(false),
       _onlyThisLANEnabled(false),
       _online(false),
-      _enabled(true)
+      _spool(path),
+      _spoolFull(false),
+      _spoolTrigger(PollTrigger),
+      _inFlightFull(false),
+      _inFlightTrigger(PollTrigger),
+      _polls(0),
+      _skippedPolls(0),
+      _enabled(true),
+      _synced(false)
 {
     qsrand(QTime::currentTime().msec());
 
@@ -46,16 +61,17 @@ Folder::Folder(const QString &alias, const QString &path, const QString& secondP
     QObject::connect(_pollTimer, SIGNAL(timeout()), this, SLOT(slotPollTimerTimeout()));
     _pollTimer->start();
 
-#ifdef USE_INOTIFY
     _watcher = new Mirall::FolderWatcher(path, this);
 
     MirallConfigFile cfg;
 
     _watcher->setIgnoreListFile( cfg.excludeFile() );
+    _watcherInterval = _watcher->eventInterval();
 
     QObject::connect(_watcher, SIGNAL(folderChanged(const QStringList &)),
                      SLOT(slotChanged(const QStringList &)));
-#endif
+    QObject::connect(_watcher, SIGNAL(pathsMoved(const PathMoveList &)),
+                     SLOT(slotPathsMoved(const PathMoveList &)));
     QObject::connect(this, SIGNAL(syncStarted()),
                      SLOT(slotSyncStarted()));
     QObject::connect(this, SIGNAL(syncFinished(const SyncResult &)),
@@ -70,6 +86,7 @@ Folder::Folder(const QString &alias, const QString &path, const QString& secondP
 
 Folder::~Folder()
 {
+    saveSpool();
 }
 
 QString Folder::alias() const
@@ -87,6 +104,11 @@ QString Folder::secondPath() const
     return _secondPath;
 }
 
+QString Folder::configuredSecondPath() const
+{
+    return _secondPath;
+}
+
 bool Folder::syncEnabled() const
 {
   return _enabled;
@@ -95,9 +117,7 @@ bool Folder::syncEnabled() const
 void Folder::setSyncEnabled( bool doit )
 {
   _enabled = doit;
-#ifdef USE_INOTIFY
   _watcher->setEventsEnabled( doit );
-#endif
   if( doit && ! _pollTimer->isActive() ) {
       _pollTimer->start();
   }
@@ -106,7 +126,14 @@ void Folder::setSyncEnabled( bool doit )
   if( doit ) {
       // undefined until next sync
       _syncResult.setStatus( SyncResult::NotYetStarted);
-      evaluateSync( QStringList() );
+      // the changes spooled while disabled are synced, the whole
+      // folder only if it never synced. An overflowed spool is
+      // a full sync already.
+      if( !_synced ) {
+          evaluateSync( QStringList(), StartupTrigger );
+      } else {
+          scheduleSpool();
+      }
   } else {
       // disabled.
       _syncResult.setStatus( SyncResult::Disabled );
@@ -151,6 +178,10 @@ int Folder::errorCount()
 void Folder::resetErrorCount()
 {
   _errorCount = 0;
+  if( _watcher->eventInterval() != _watcherInterval ) {
+    qDebug() << "Reset watcher interval to " << _watcherInterval;
+    _watcher->setEventInterval( _watcherInterval );
+  }
 }
 
 void Folder::incrementErrorCount()
@@ -159,29 +190,70 @@ void Folder::incrementErrorCount()
   // of the watcher is doubled.
   _errorCount++;
   if( _errorCount > 1 ) {
-#ifdef USE_INOTIFY
     int interval = _watcher->eventInterval();
-    int newInt = 2*interval;
+    int newInt = qMin(2*interval, MAX_WATCHER_INTERVAL_MSEC);
     qDebug() << "Set new watcher interval to " << newInt;
     _watcher->setEventInterval( newInt );
-#endif
     _errorCount = 0;
   }
 }
 
+int Folder::changeLatency() const
+{
+  return _watcher->lastLatency();
+}
+
 SyncResult Folder::syncResult() const
 {
   return _syncResult;
 }
 
-void Folder::evaluateSync(const QStringList &pathList)
+QList<SyncProfile> Folder::profileHistory() const
+{
+    return _profiles;
+}
+
+void Folder::recordProfile(const SyncProfile &profile)
+{
+    if( profile.isEmpty() )
+        return;
+
+    qDebug() << "*" << alias() << "sync phases:" << profile.toString();
+    for( int i = 0; i < SyncProfile::PhaseCount; ++i ) {
+        const SyncProfile::Phase phase = SyncProfile::Phase(i);
+        const int median = SyncProfile::medianTime( _profiles, phase );
+        // short phases vary a lot, they are not worth a warning
+        if( median >= 0 && profile.time( phase ) > qMax( 2 * median, median + 1000 ) ) {
+            qDebug() << "*" << alias() << SyncProfile::phaseName( phase ) << "took"
+                     << profile.time( phase ) << "msec, usually" << median << "msec";
+        }
+    }
+
+    _profiles.append( profile );
+    while( _profiles.size() > PROFILE_HISTORY_SIZE )
+        _profiles.removeFirst();
+}
+
+void Folder::evaluateSync(const QStringList &pathList, SyncTrigger trigger)
 {
+  // kept for the next sync, whether it can start now or not
+  spool( pathList, trigger );
+  scheduleSpool();
+}
+
+void Folder::scheduleSpool()
+{
+  if( !_spoolFull && _spool.isEmpty() )
+    return;
+
   if( !_enabled ) {
     qDebug() << "*" << alias() << "sync skipped, disabled!";
     return;
   }
   if (!_online && onlyOnlineEnabled()) {
     qDebug() << "*" << alias() << "sync skipped, not online";
+    // polled again, the spool is synced once back online
+    _pollTimer->start();
     return;
   }
 
@@ -195,6 +267,128 @@ void Folder::evaluateSync(const QStringList &pathList)
 
 }
 
+void Folder::spool(const QStringList &pathList, SyncTrigger trigger)
+{
+  if( _spoolFull || !_spool.isEmpty() ) {
+    _spoolTrigger = qMin( _spoolTrigger, trigger );
+  } else {
+    _spoolTrigger = trigger;
+  }
+  if( pathList.isEmpty() ) {
+    _spoolFull = true;
+    _spool.clear();
+    return;
+  }
+  if( _spoolFull )
+    return;
+  foreach( const QString &p, pathList ) {
+    _spool.note( p, PendingTree::Modified );
+  }
+}
+
+QStringList Folder::takeSpooledPaths()
+{
+  QStringList paths;
+  // a collapsed root is the whole folder as well
+  if( !_spoolFull && !_spool.isCovered( path() ) ) {
+    paths = _spool.paths();
+  }
+  _inFlight = paths;
+  _inFlightFull = paths.isEmpty();
+  _inFlightTrigger = _spoolTrigger;
+  _spool.clear();
+  _spoolFull = false;
+  _spoolTrigger = PollTrigger;
+  qDebug() << "*" << alias() << "syncs" << (paths.isEmpty() ? QString("everything") : QString::number(paths.size()) + " paths");
+  // checkpoint, the paths are done once the sync succeeded
+  saveSpool();
+  return paths;
+}
+
+bool Folder::cancelSync()
+{
+  return false;
+}
+
+Folder::SyncTrigger Folder::spooledTrigger() const
+{
+  return _spoolTrigger;
+}
+
+int Folder::spooledCost() const
+{
+  if( _spoolFull || _spool.isCovered( path() ) )
+    return SyncQueue::FullSyncCost;
+  return _spool.nodeCount();
+}
+
+void Folder::setSpoolFile(const QString &file)
+{
+  _spoolFile = file;
+  loadSpool();
+}
+
+void Folder::loadSpool()
+{
+  if( _spoolFile.isEmpty() )
+    return;
+  QFile file( _spoolFile );
+  if( !file.open( QIODevice::ReadOnly ) )
+    return;
+
+  QStringList paths;
+  QTextStream in( &file );
+  in.setCodec( "UTF-8" );
+  while( !in.atEnd() ) {
+    const QString line = in.readLine();
+    if( line == path() ) {
+      // the whole folder
+      paths.clear();
+      break;
+    }
+    if( line.startsWith( path() + QLatin1Char('/') ) )
+      paths.append( line );
+  }
+  file.close();
+  // everything is in memory again, saved on exit
+  file.remove();
+
+  qDebug() << "*" << alias() << "has" << (paths.isEmpty() ? QString("a full sync") : QString::number(paths.size()) + " paths")
+           << "left from the last run";
+  evaluateSync( paths, StartupTrigger );
+}
+
+void Folder::saveSpool()
+{
+  if( _spoolFile.isEmpty() )
+    return;
+
+  // the spool, the paths of the running sync and the changes
+  // the watcher holds back all wait for a sync to succeed.
+  QStringList paths;
+  if( _spoolFull || _inFlightFull ) {
+    paths.append( path() );
+  } else {
+    paths = _spool.paths() + _inFlight + _watcher->pendingPaths();
+    paths.removeDuplicates();
+  }
+  if( paths.isEmpty() ) {
+    QFile::remove( _spoolFile );
+    return;
+  }
+
+  QFile file( _spoolFile );
+  if( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) ) {
+    qWarning() << "* Can not save the pending changes of" << alias() << "to" << _spoolFile;
+    return;
+  }
+  QTextStream out( &file );
+  out.setCodec( "UTF-8" );
+  foreach( const QString &p, paths ) {
+    out << p << '\n';
+  }
+}
+
 void Folder::startSync( const QStringList &pathList )
 {
     _syncResult = SyncResult( SyncResult::SyncRunning );
@@ -202,43 +396,111 @@ void Folder::startSync( const QStringList &pathList )
 }
 
 void Folder::slotPollTimerTimeout()
+{
+    _polls++;
+    // changes spooled while offline are synced first, the
+    // remote is checked by the poll after that sync.
+    if( _spoolFull || !_spool.isEmpty() ) {
+        scheduleSpool();
+        return;
+    }
+    // the watcher hands its changes over by itself
+    pollRemote();
+}
+
+void Folder::pollRemote()
+{
+    pollSync();
+}
+
+void Folder::pollSync()
 {
     qDebug() << "* Polling" << alias() << "for changes. Ignoring all pending events until now";
-#ifdef USE_INOTIFY
     _watcher->clearPendingEvents();
-#endif
-    evaluateSync(QStringList());
+    evaluateSync(QStringList(), PollTrigger);
+}
+
+void Folder::pollSkipped()
+{
+    _skippedPolls++;
+    qDebug() << "*" << alias() << "did not change, skipped" << _skippedPolls << "of" << _polls << "polls";
+    if( syncEnabled() ) {
+        _pollTimer->start();
+    }
+}
+
+int Folder::skippedPolls() const
+{
+    return _skippedPolls;
+}
+
+int Folder::polls() const
+{
+    return _polls;
 }
 
 void Folder::slotOnlineChanged(bool online)
 {
     qDebug() << "* " << alias() << "is" << (online ? "now online" : "no longer online");
     _online = online;
+    if( _online ) {
+        scheduleSpool();
+    }
 }
 
 void Folder::slotChanged(const QStringList &pathList)
 {
     qDebug() << "** Changed was notified on " << pathList;
-    evaluateSync(pathList);
+    // only the first notification of the watcher comes without
+    // paths, it asks for the initial sync.
+    evaluateSync(pathList, pathList.isEmpty() ? StartupTrigger : LocalChangeTrigger);
+}
+
+void Folder::slotPathsMoved(const PathMoveList &moves)
+{
+    _pendingMoves += moves;
+}
+
+PathMoveList Folder::pendingMoves() const
+{
+    return _pendingMoves;
 }
 
 void Folder::slotSyncStarted()
 {
-    // disable events until syncing is done
-#ifdef USE_INOTIFY
+    // the sync got the moves with startSync()
+    _pendingMoves.clear();
+    // collect the events until syncing is done
     _watcher->setEventsEnabled(false);
-#endif
 }
 
 void Folder::slotSyncFinished(const SyncResult &result)
 {
-#ifdef USE_INOTIFY
+    // changes made during the sync are handed over now
     _watcher->setEventsEnabled(true);
-#endif
+
+    // a cancelled run did not change anything, its paths are
+    // synced again. The paths of a failed run are not known to
+    // be in sync, the next run looks at everything.
+    const bool cancelled = result.status() == SyncResult::NotYetStarted;
+    const QStringList inFlight = _inFlight;
+    const bool inFlightFull = _inFlightFull;
+    _inFlight.clear();
+    _inFlightFull = false;
+    if( !cancelled && result.status() != SyncResult::Success ) {
+        spool( QStringList(), PollTrigger );
+    }
 
     _syncResult = result;
+    recordProfile( result.profile() );
     emit syncStateChange();
 
+    // a good sync ends the back off of the watcher interval
+    if( result.status() == SyncResult::Success ) {
+        _synced = true;
+        resetErrorCount();
+    }
+
     // reenable the poll timer if folder is sync enabled
     if( syncEnabled() ) {
         qDebug() << "* " << alias() << "Poll timer enabled with " << _pollTimer->interval() << "milliseconds";
@@ -247,6 +509,12 @@ void Folder::slotSyncFinished(const SyncResult &result)
         qDebug() << "* Not enabling poll timer for " << alias();
         _pollTimer->stop();
     }
+
+    if( cancelled ) {
+        qDebug() << "*" << alias() << "was cancelled, its sync is scheduled again";
+        evaluateSync( inFlightFull ? QStringList() : inFlight, _inFlightTrigger );
+    }
+    saveSpool();
 }
 
 void Folder::setBackend( const QString& b )
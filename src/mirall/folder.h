@@ -22,6 +22,8 @@
 #include <QHash>
 
 #include "mirall/syncresult.h"
+#include "mirall/folderwatcher.h"
+#include "mirall/pendingtree.h"
 
 class QAction;
 class QTimer;
@@ -29,10 +31,6 @@ class QIcon;
 
 namespace Mirall {
 
-#ifdef USE_INOTIFY
-class FolderWatcher;
-#endif
-
 class Folder : public QObject
 {
     Q_OBJECT
@@ -43,6 +41,15 @@ public:
 
     typedef QHash<QString, Folder*> Map;
 
+    /**
+     * What asked for a sync, most urgent first
+     */
+    enum SyncTrigger {
+        LocalChangeTrigger,
+        StartupTrigger,
+        PollTrigger
+    };
+
     /**
      * alias or nickname
      */
@@ -54,6 +61,12 @@ public:
     QString path() const;
     virtual QString secondPath() const;
 
+    /**
+     * The second path as it was configured, a full url for
+     * remote folders. secondPath() can differ from it.
+     */
+    QString configuredSecondPath() const;
+
     /**
      * switch sync on or off
      * If the sync is switched off, the startSync method is not going to
@@ -74,6 +87,15 @@ public:
      */
     virtual void startSync(const QStringList &pathList) = 0;
 
+    /**
+     * Asks a running sync to stop early, it finishes with the
+     * status SyncResult::NotYetStarted if it did. Its paths go
+     * back to the spool and the folder is scheduled again.
+     * Returns false if the folder can not cancel its sync, or
+     * if the sync is past the point where it could stop.
+     */
+    virtual bool cancelSync();
+
     /**
      * True if the folder is busy and can't initiate
      * a synchronization
@@ -112,11 +134,22 @@ public:
 
     void incrementErrorCount();
 
+    /**
+     * msecs the last local changes waited before their sync
+     * was requested, -1 if there were none yet.
+     */
+    int changeLatency() const;
+
     /**
      * return the last sync result with error message and status
      */
      SyncResult syncResult() const;
 
+    /**
+     * The profiles of the last syncs, the oldest first
+     */
+    QList<SyncProfile> profileHistory() const;
+
      /**
      * set the backend description string.
      */
@@ -127,13 +160,74 @@ public:
      QString backend() const;
 
      QIcon icon( int size ) const;
+
+    /**
+     * File the changes waiting for the next sync are kept in
+     * across restarts. What an earlier run left there is read
+     * and scheduled.
+     */
+    void setSpoolFile(const QString &file);
+
+    /**
+     * The paths changed since the last sync started, also
+     * while the folder was syncing, offline or disabled. The
+     * list is empty if the whole folder needs a sync. The
+     * spool is empty afterwards.
+     *
+     * The paths stay in the spool file until the sync they
+     * are handed to succeeded, a sync cut short by a crash
+     * runs again after the restart.
+     */
+    QStringList takeSpooledPaths();
+
+    /**
+     * The most urgent trigger of the spooled changes, and the
+     * number of spooled paths, SyncQueue::FullSyncCost if the
+     * whole folder needs a sync.
+     */
+    SyncTrigger spooledTrigger() const;
+    int spooledCost() const;
+
+    /**
+     * Polls which found nothing to sync, and all polls so far
+     */
+    int skippedPolls() const;
+    int polls() const;
+
   QTimer   *_pollTimer;
 
 public slots:
      void slotSyncFinished(const SyncResult &);
      void slotChanged(const QStringList &pathList = QStringList() );
+     void slotPathsMoved(const PathMoveList &moves);
 
 protected:
+    /**
+     * Moves reported by the watcher since the last sync
+     * started. The paths are part of the changed paths
+     * handed to startSync() as well.
+     */
+    PathMoveList pendingMoves() const;
+
+    /**
+     * Called by the poll timer if no local change is waiting.
+     * The default syncs the whole folder, a folder which can
+     * tell cheaply whether the remote side changed overrides
+     * it and calls pollSync() or pollSkipped().
+     */
+    virtual void pollRemote();
+
+    /**
+     * Asks for the sync of the whole folder a poll wants
+     */
+    void pollSync();
+
+    /**
+     * Ends a poll which found no changes, the next one is
+     * due after the poll interval.
+     */
+    void pollSkipped();
+
     /**
      * The minimum amounts of seconds to wait before
      * doing a full sync to see if the remote changed
@@ -153,10 +247,10 @@ signals:
     void scheduleToSync( const QString& );
 
 protected:
-#ifdef USE_INOTIFY
     FolderWatcher *_watcher;
-#endif
   int _errorCount;
+  // watcher interval before backing off on errors
+  int _watcherInterval;
 
 private:
 
@@ -164,7 +258,19 @@ private:
      * Starts a sync (calling startSync)
      * if the policies allow for it
      */
-    void evaluateSync(const QStringList &pathList);
+    void evaluateSync(const QStringList &pathList, SyncTrigger trigger);
+
+    // adds the paths to the spool, an empty list asks for
+    // a sync of the whole folder
+    void spool(const QStringList &pathList, SyncTrigger trigger);
+    // asks for a sync of the spool if there is anything in it
+    // and the policies allow for it
+    void scheduleSpool();
+    void loadSpool();
+    void saveSpool();
+    // adds the profile to the history, phases much slower than
+    // usual are logged
+    void recordProfile(const SyncProfile &profile);
 
     QString   _path;
     QString   _secondPath;
@@ -173,8 +279,23 @@ private:
     bool      _onlyThisLANEnabled;
     QNetworkConfigurationManager _networkMgr;
     bool       _online;
+    PathMoveList _pendingMoves;
+    // changes waiting for the next sync
+    PendingTree _spool;
+    bool       _spoolFull;
+    SyncTrigger _spoolTrigger;
+    // the spool handed to the running sync
+    QStringList _inFlight;
+    bool       _inFlightFull;
+    SyncTrigger _inFlightTrigger;
+    QString    _spoolFile;
+    int        _polls;
+    int        _skippedPolls;
     bool       _enabled;
+    // a sync succeeded since the start
+    bool       _synced;
     SyncResult _syncResult;
+    QList<SyncProfile> _profiles;
     QString    _backend;
 
 protected slots:
@@ -22,22 +22,33 @@
 #include "mirall/syncresult.h"
 #include "mirall/folderman.h"
 #include "mirall/inotify.h"
+#include "mirall/syncexecutor.h"
+
+// syncs of one server running at the same time
+#define DEFAULT_SYNCS_PER_SERVER 1
+// a sync is mostly waiting for the network, but the local
+// discovery keeps a core busy.
+#define MAX_PARALLEL_SYNCS 4
 
 namespace Mirall {
 
 FolderMan::FolderMan(QObject *parent) :
     QObject(parent),
-    _folderToDelete(false)
+    _maxParallelSyncs(qBound(1, QThread::idealThreadCount(), MAX_PARALLEL_SYNCS)),
+    _maxSyncsPerServer(DEFAULT_SYNCS_PER_SERVER)
 {
     // if QDir::mkpath would not be so stupid, I would not need to have this
     // duplication of folderConfigPath() here
     QDir storageDir(QDesktopServices::storageLocation(QDesktopServices::DataLocation));
     storageDir.mkpath("folders");
+    storageDir.mkpath("spool");
     _folderConfigPath = QDesktopServices::storageLocation(QDesktopServices::DataLocation) + "/folders";
 
 #ifdef USE_INOTIFY
     Mirall::INotify::initialize();
 #endif
+    // a worker thread for each sync that may run at a time
+    SyncExecutor::initialize( _maxParallelSyncs );
 
     _folderChangeSignalMapper = new QSignalMapper(this);
     connect(_folderChangeSignalMapper, SIGNAL(mapped(const QString &)),
@@ -49,6 +60,8 @@ FolderMan::~FolderMan()
     foreach (Folder *folder, _folderMap) {
         delete folder;
     }
+    // the folders waited for their syncs
+    SyncExecutor::cleanup();
 }
 
 Mirall::Folder::Map FolderMan::map()
@@ -170,7 +183,17 @@ Folder* FolderMan::setupFolderFromConfigFile(const QString &file) {
     // folder->setOnlyOnlineEnabled(settings.value("folder/onlyOnline", false).toBool());
     folder->setOnlyThisLANEnabled(settings.value("folder/onlyThisLAN", false).toBool());
 
-    _folderMap[file] = folder;
+    addFolder( folder );
+
+    // changes which did not make it into a sync before the last exit
+    folder->setSpoolFile( spoolFile( file ) );
+
+    return folder;
+}
+
+void FolderMan::addFolder( Folder *folder )
+{
+    _folderMap[folder->alias()] = folder;
 
     qDebug() << "Adding folder to Folder Map " << folder;
     /* Use a signal mapper to connect the signals to the alias */
@@ -180,8 +203,6 @@ Folder* FolderMan::setupFolderFromConfigFile(const QString &file) {
     connect(folder, SIGNAL(syncFinished(SyncResult)), SLOT(slotFolderSyncFinished(SyncResult)));
 
     _folderChangeSignalMapper->setMapping( folder, folder->alias() );
-
-    return folder;
 }
 
 void FolderMan::disableFoldersWithRestore()
@@ -235,72 +256,241 @@ SyncResult FolderMan::syncResult( const QString& alias )
     return res;
 }
 
+int FolderMan::maxParallelSyncs() const
+{
+    return _maxParallelSyncs;
+}
+
+void FolderMan::setMaxParallelSyncs( int syncs )
+{
+    _maxParallelSyncs = qMax( syncs, 1 );
+    SyncExecutor::instance()->setWorkerCount( _maxParallelSyncs );
+    slotScheduleFolderSync();
+}
+
+int FolderMan::maxSyncsPerServer() const
+{
+    return _maxSyncsPerServer;
+}
+
+void FolderMan::setMaxSyncsPerServer( int syncs )
+{
+    _maxSyncsPerServer = qMax( syncs, 1 );
+    slotScheduleFolderSync();
+}
+
+QStringList FolderMan::runningFolders() const
+{
+    return _runningFolders.keys();
+}
+
+int FolderMan::queueDepth() const
+{
+    return _scheduleQueue.size();
+}
+
+int FolderMan::waitTime( const QString& alias ) const
+{
+    if( _scheduleQueue.contains( alias ) ) {
+        return int( QDateTime::currentMSecsSinceEpoch() - _scheduleQueue.queuedAt( alias ) );
+    }
+    return _waitTimes.value( alias, -1 );
+}
+
+int FolderMan::waitPercentile( Folder::SyncTrigger trigger, int percent ) const
+{
+    return _scheduleQueue.waitPercentile( trigger, percent );
+}
+
+QString FolderMan::serverOf( Folder *f ) const
+{
+    // secondPath() of an ownCloud folder is relative to the
+    // server, the configured one has the full url.
+    const QUrl url( f->configuredSecondPath() );
+    const QString scheme = url.scheme();
+    if( scheme == QLatin1String("http") || scheme == QLatin1String("owncloud") ) {
+        return url.host() + QLatin1Char(':') + QString::number( url.port( 80 ) );
+    }
+    if( scheme == QLatin1String("https") || scheme == QLatin1String("ownclouds") ) {
+        return url.host() + QLatin1Char(':') + QString::number( url.port( 443 ) );
+    }
+    return QString();
+}
+
+bool FolderMan::canStartSync( const QString& alias ) const
+{
+    if( _runningFolders.contains( alias ) || _runningFolders.size() >= _maxParallelSyncs ) {
+        return false;
+    }
+    const QString server = serverOf( _folderMap.value( alias ) );
+    if( server.isEmpty() ) {
+        return true;
+    }
+    int running = 0;
+    foreach( const RunningSync& sync, _runningFolders ) {
+        if( sync.server == server ) running++;
+    }
+    return running < _maxSyncsPerServer;
+}
+
 /*
   * if a folder wants to be synced, it calls this slot and is added
   * to the queue. The slot to actually start a sync is called afterwards.
   */
 void FolderMan::slotScheduleSync( const QString& alias )
 {
-    if( alias.isEmpty() ) return;
+    if( alias.isEmpty() || !_folderMap.contains( alias ) ) return;
 
+    Folder *f = _folderMap[alias];
     qDebug() << "Schedule folder " << alias << " to sync!";
-    if( _currentSyncFolder == alias ) {
-        // the current folder is currently syncing.
-    }
-
-    if( _scheduleQueue.contains( alias ) ) {
-        qDebug() << " II> Sync for folder " << alias << " already scheduled, do not enqueue!";
-    } else {
-        _scheduleQueue.append( alias );
-
-        slotScheduleFolderSync();
-    }
+    // a queued folder is updated with its latest changes, a
+    // running one stays queued until its current sync finished.
+    // a preempted sync keeps the time it was first queued at,
+    // or it would lose its aging with every preemption.
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    _scheduleQueue.enqueue( alias, f->spooledTrigger(), f->spooledCost(),
+                            _requeueAt.contains( alias ) ? _requeueAt.take( alias ) : now );
+
+    slotScheduleFolderSync();
 }
 
 /*
   * slot to start folder syncs.
   * It is either called from the slot where folders enqueue themselves for
-  * syncing or after a folder sync was finished.
+  * syncing or after a folder sync was finished. The most urgent folder goes
+  * first, one which has to wait for its server does not hold back the ones
+  * behind it.
   */
 void FolderMan::slotScheduleFolderSync()
 {
-    if( !_currentSyncFolder.isEmpty() ) {
-        qDebug() << "Currently folder " << _currentSyncFolder << " is running, wait for finish!";
+    if( _scheduleQueue.isEmpty() ) {
         return;
     }
 
-    if( ! _scheduleQueue.isEmpty() ) {
-        const QString alias = _scheduleQueue.takeFirst();
-        if( _folderMap.contains( alias ) ) {
-            Folder *f = _folderMap[alias];
-            _currentSyncFolder = alias;
-            f->startSync( QStringList() );
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    foreach( const QString& alias, _scheduleQueue.ordered( now ) ) {
+        if( _runningFolders.size() >= _maxParallelSyncs ) {
+            break;
+        }
+        if( !_folderMap.contains( alias ) ) {
+            _scheduleQueue.remove( alias );
+            continue;
+        }
+        if( !canStartSync( alias ) ) {
+            continue;
+        }
+
+        Folder::SyncTrigger trigger;
+        RunningSync sync;
+        sync.cost = _scheduleQueue.costOf( alias );
+        sync.queuedAt = _scheduleQueue.take( alias, &trigger );
+        sync.preempted = false;
+        const int waited = int( now - sync.queuedAt );
+        _waitTimes.insert( alias, waited );
+        _scheduleQueue.recordWait( trigger, waited );
+
+        Folder *f = _folderMap[alias];
+        sync.server = serverOf( f );
+        sync.trigger = trigger;
+        _runningFolders.insert( alias, sync );
+        qDebug() << "Starting sync of" << alias << "( trigger" << trigger << ") after waiting" << waited << "msec,"
+                 << _runningFolders.size() << "running," << _scheduleQueue.size() << "queued";
+        qDebug() << "  wait percentiles 50/90/99 for the trigger:" << _scheduleQueue.waitPercentile( trigger, 50 )
+                 << _scheduleQueue.waitPercentile( trigger, 90 ) << _scheduleQueue.waitPercentile( trigger, 99 ) << "msec";
+        f->startSync( f->takeSpooledPaths() );
+    }
+    if( _scheduleQueue.isEmpty() ) {
+        return;
+    }
+    qDebug() << _scheduleQueue.size() << "folders wait for" << _runningFolders.keys() << "to finish";
+
+    // a small local change does not wait for a full scan, the
+    // scan is cancelled and continues after it.
+    foreach( const QString& alias, _scheduleQueue.ordered( now ) ) {
+        if( _scheduleQueue.triggerOf( alias ) != Folder::LocalChangeTrigger
+                || _scheduleQueue.costOf( alias ) == SyncQueue::FullSyncCost
+                || _runningFolders.contains( alias ) ) {
+            continue;
+        }
+        if( preemptFor( alias ) ) {
+            break;
         }
     }
 }
 
+bool FolderMan::preemptFor( const QString& alias )
+{
+    const QString server = serverOf( _folderMap.value( alias ) );
+    const bool allBusy = _runningFolders.size() >= _maxParallelSyncs;
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    QHash<QString, RunningSync>::iterator it;
+    for( it = _runningFolders.begin(); it != _runningFolders.end(); ++it ) {
+        RunningSync& sync = it.value();
+        if( sync.preempted || sync.trigger == Folder::LocalChangeTrigger
+                || sync.cost != SyncQueue::FullSyncCost ) {
+            continue;
+        }
+        // a scan preempted a moment ago, or one which waited long
+        // enough already, runs to its end. Otherwise a stream of
+        // small changes could keep it from ever finishing.
+        const bool recentlyPreempted = _preemptedAt.contains( it.key() )
+                && now - _preemptedAt.value( it.key() ) < _scheduleQueue.agingStep();
+        if( recentlyPreempted || now - sync.queuedAt > _scheduleQueue.agingStep() ) {
+            continue;
+        }
+        if( !allBusy && ( server.isEmpty() || sync.server != server ) ) {
+            continue;
+        }
+        Folder *f = _folderMap.value( it.key() );
+        if( f && f->cancelSync() ) {
+            qDebug() << "Preempting the full sync of" << it.key() << "for" << alias;
+            sync.preempted = true;
+            _preemptedAt.insert( it.key(), now );
+            return true;
+        }
+    }
+    return false;
+}
+
 void FolderMan::slotFolderSyncStarted( )
 {
-    qDebug() << ">===================================== sync started for " << _currentSyncFolder;
+    Folder *f = qobject_cast<Folder*>( sender() );
+    qDebug() << ">===================================== sync started for " << (f ? f->alias() : QString());
 }
 
 /*
   * a folder indicates that its syncing is finished.
-  * Start the next sync after the system had some milliseconds to breath.
+  * Start the next syncs right away, the finished one does not
+  * block anything anymore.
   */
-void FolderMan::slotFolderSyncFinished( const SyncResult& )
+void FolderMan::slotFolderSyncFinished( const SyncResult& result )
 {
-    qDebug() << "<===================================== sync finsihed for " << _currentSyncFolder;
+    Folder *f = qobject_cast<Folder*>( sender() );
+    if( !f ) return;
+    const QString alias = f->alias();
+    qDebug() << "<===================================== sync finsihed for " << alias;
+    const RunningSync sync = _runningFolders.take( alias );
+    // a preempted sync which ended anyway keeps nothing, the
+    // folder queues up like any other the next time.
+    if( sync.preempted && result.status() == SyncResult::NotYetStarted ) {
+        // scheduled again already, or soon
+        if( _scheduleQueue.contains( alias ) ) {
+            _scheduleQueue.enqueue( alias, _scheduleQueue.triggerOf( alias ),
+                                    _scheduleQueue.costOf( alias ), sync.queuedAt );
+        } else {
+            _requeueAt.insert( alias, sync.queuedAt );
+        }
+    }
 
     // check if the folder is scheduled to be deleted. The flag is set in slotRemoveFolder
     // after the user clicked to delete it.
-    if( _folderToDelete ) {
+    if( _foldersToDelete.remove( alias ) ) {
         qDebug() << " !! This folder is going to be deleted now!";
-        removeFolder( _currentSyncFolder );
-        _folderToDelete = false;
+        removeFolder( alias );
     }
-    _currentSyncFolder = QString();
-    QTimer::singleShot(200, this, SLOT(slotScheduleFolderSync()));
+    QTimer::singleShot(0, this, SLOT(slotScheduleFolderSync()));
 }
 
 /**
@@ -332,9 +522,9 @@ void FolderMan::slotRemoveFolder( const QString& alias )
 {
     if( alias.isEmpty() ) return;
 
-    if( _currentSyncFolder == alias ) {
+    if( _runningFolders.contains( alias ) ) {
         // attention: sync is currently running!
-        _folderToDelete = true; // flag for the sync finished slot
+        _foldersToDelete.insert( alias ); // flag for the sync finished slot
     } else {
         removeFolder(alias);
     }
@@ -346,6 +536,12 @@ void FolderMan::removeFolder( const QString& alias )
     if( _folderMap.contains( alias )) {
       qDebug() << "Removing " << alias;
       Folder *f = _folderMap.take( alias );
+      _scheduleQueue.remove( alias );
+      _waitTimes.remove( alias );
+      _preemptedAt.remove( alias );
+      _requeueAt.remove( alias );
+      // nothing is left to sync
+      f->setSpoolFile( QString() );
       f->deleteLater();
     } else {
       qDebug() << "!! Can not remove " << alias << ", not in folderMap.";
@@ -356,6 +552,12 @@ void FolderMan::removeFolder( const QString& alias )
         qDebug() << "Remove folder config file " << file.fileName();
       file.remove();
     }
+    QFile::remove( spoolFile( alias ) );
+}
+
+QString FolderMan::spoolFile( const QString& alias ) const
+{
+    return QDesktopServices::storageLocation(QDesktopServices::DataLocation) + "/spool/" + alias;
 }
 
 }
@@ -18,9 +18,12 @@
 
 #include <QObject>
 #include <QQueue>
+#include <QSet>
+#include <QStringList>
 
 #include "mirall/folder.h"
 #include "mirall/folderwatcher.h"
+#include "mirall/syncqueue.h"
 
 class QSignalMapper;
 
@@ -68,6 +71,44 @@ public:
       */
     Folder* setupFolderFromConfigFile(const QString & );
 
+    /**
+      * adds a folder which is not read from the configuration,
+      * the folder manager owns and schedules it from now on.
+      */
+    void addFolder( Folder* );
+
+    /**
+      * Folder syncs running at the same time at most, and the
+      * ones talking to the same server. Folders with a local
+      * target only count for the first limit.
+      */
+    int maxParallelSyncs() const;
+    void setMaxParallelSyncs( int );
+    int maxSyncsPerServer() const;
+    void setMaxSyncsPerServer( int );
+
+    /**
+      * aliases of the folders syncing right now
+      */
+    QStringList runningFolders() const;
+
+    /**
+      * number of folders waiting for their sync to start
+      */
+    int queueDepth() const;
+
+    /**
+      * msecs the folder waited in the queue before its last sync
+      * started, or is waiting now. -1 if it never was scheduled.
+      */
+    int waitTime( const QString& ) const;
+
+    /**
+      * msecs percent of the recent syncs with the trigger waited
+      * in the queue at most, -1 if there were none.
+      */
+    int waitPercentile( Folder::SyncTrigger, int percent ) const;
+
 signals:
     /**
       * signal to indicate a folder named by alias has changed its sync state.
@@ -88,7 +129,8 @@ private slots:
     // slot to add a folder to the syncing queue
     void slotScheduleSync( const QString & );
 
-    // slot to take the next folder from queue and start syncing.
+    // slot to start the syncs of queued folders, as many
+    // as the limits allow.
     void slotScheduleFolderSync();
 
 private:
@@ -98,15 +140,43 @@ private:
 
     void removeFolder( const QString& );
 
+    // where the unsynced changes of a folder survive restarts
+    QString spoolFile( const QString& alias ) const;
+
+    // the server a folder syncs with, empty for local targets
+    QString serverOf( Folder* ) const;
+    bool canStartSync( const QString& alias ) const;
+    // cancels a background full sync which keeps the folder
+    // from starting, returns true if one was cancelled
+    bool preemptFor( const QString& alias );
+
+    struct RunningSync {
+        QString server;
+        Folder::SyncTrigger trigger;
+        int cost;
+        // when the sync was first queued, kept across preemptions
+        qint64 queuedAt;
+        bool preempted;
+    };
+
     FolderWatcher *_configFolderWatcher;
     Folder::Map    _folderMap;
     QHash<QString, bool> _folderEnabledMap;
     QString        _folderConfigPath;
     OwncloudSetup *_ownCloudSetup;
     QSignalMapper *_folderChangeSignalMapper;
-    QString        _currentSyncFolder;
-    QStringList    _scheduleQueue;
-    bool           _folderToDelete;
+    QHash<QString, RunningSync> _runningFolders;
+    // when a folder was last asked to stop for a more urgent one
+    QHash<QString, qint64> _preemptedAt;
+    // the queue time a preempted folder gets back once it is
+    // scheduled again
+    QHash<QString, qint64> _requeueAt;
+    SyncQueue      _scheduleQueue;
+    QHash<QString, int> _waitTimes;
+    // removed while syncing, deleted once the sync finished
+    QSet<QString>  _foldersToDelete;
+    int            _maxParallelSyncs;
+    int            _maxSyncsPerServer;
 };
 
 }
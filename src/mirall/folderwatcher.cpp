@@ -15,22 +15,27 @@
 // event masks
 #include <stdint.h>
 
+#include <QFile>
 #include <QFileInfo>
 #include <QFlags>
+#include <QMap>
+#include <QDateTime>
 #include <QDebug>
 #include <QDir>
 #include <QMutexLocker>
 #include <QStringList>
 #include <QTimer>
 
-#include "mirall/folder.h"
-#include "mirall/inotify.h"
 #include "mirall/folderwatcher.h"
 #include "mirall/fileutils.h"
+#include "mirall/directorypoller.h"
+#include "mirall/watchbudget.h"
 
 #ifdef USE_INOTIFY
 #include <sys/inotify.h>
+#include <sys/vfs.h>
 #endif
+#include <sys/stat.h>
 
 static const uint32_t standard_event_mask =
 #ifdef USE_INOTIFY
@@ -41,35 +46,164 @@ static const uint32_t standard_event_mask =
 /* minimum amount of seconds between two
    events  to consider it a new event */
 #define DEFAULT_EVENT_INTERVAL_MSEC 1000
+/* time spent adding watches before the event
+   loop gets control back */
+#define WATCH_SLICE_MSEC 20
+/* after a queue overflow, folders which had events during
+   this time before the last complete delivery are rescanned
+   even if their mtime did not change (files written in place) */
+#define OVERFLOW_HOT_WINDOW_MSEC 10000
+/* time an IN_MOVED_FROM waits for its IN_MOVED_TO before
+   it is taken as a delete (moved out of the tree) */
+#define MOVE_PAIR_WINDOW_MSEC 500
+/* default upper bound between the first pending change
+   and the notification */
+#define DEFAULT_MAX_LATENCY_MSEC 15000
+/* the settle window never grows beyond this */
+#define MAX_SETTLE_WINDOW_MSEC 5000
+/* time between two passes of the polling backend, also used
+   for the folders polled after the watch limit was reached */
+#define POLL_INTERVAL_MSEC 2000
+/* a polled folder which changed during this time is worth a watch */
+#define HOT_FOLDER_WINDOW_MSEC 60000
+/* a watched folder without events for this long can give its
+   watch to a hot polled folder */
+#define COLD_FOLDER_AGE_MSEC (10 * 60 * 1000)
+/* watches are moved around at most this often, and only a few
+   at a time, finding the cold folders walks all watches in slices */
+#define REBALANCE_INTERVAL_MSEC 30000
+#define MAX_WATCH_SWAPS 16
+/* watches looked at between two checks of the slice time */
+#define WATCH_WALK_CHUNK 256
 
 namespace Mirall {
 
+namespace {
+
+// collects what is found in a folder which was just created
+class NewFolderVisitor : public FileUtils::ScanVisitor
+{
+public:
+    bool visit(const QString &dir, const char *name,
+               FileUtils::EntryType type, const struct stat *)
+    {
+        entries.append(qMakePair(dir + QLatin1Char('/') + QFile::decodeName(name),
+                                 type == FileUtils::DirEntry));
+        return false;
+    }
+
+    QList<QPair<QString, bool> > entries;
+};
+
+}
+
 FolderWatcher::FolderWatcher(const QString &root, QObject *parent)
     : QObject(parent),
       _eventsEnabled(true),
       _eventInterval(DEFAULT_EVENT_INTERVAL_MSEC),
+      _backend(backendForPath(root)),
+      _poller(0),
+      _pollTimer(0),
       _root(root),
+      _pending(root),
       _processTimer(new QTimer(this)),
-      _lastMask(0),
-      _initialSyncDone(false)
+      _maxLatency(DEFAULT_MAX_LATENCY_MSEC),
+      _firstPending(0),
+      _lastPending(0),
+      _averageGap(-1),
+      _lastLatency(-1),
+      _moveTimer(new QTimer(this)),
+      _initialSyncDone(false),
+      _watchStepScheduled(false),
+      _ready(false),
+      _watchCount(0),
+      _setupTime(-1),
+      _lastDelivery(QDateTime::currentMSecsSinceEpoch()),
+      _recoveryScheduled(false),
+      _cleanSince(0),
+      _overflowCount(0),
+      _lastRecoveryTime(-1),
+      _budgetTimer(0),
+      _budgetPassRunning(false),
+      _lastRebalance(0),
+      _rebalanceCursor(-1)
 {
-#ifdef USE_INOTIFY
+    qRegisterMetaType<PathMoveList>("PathMoveList");
+
     _processTimer->setSingleShot(true);
     QObject::connect(_processTimer, SIGNAL(timeout()), this, SLOT(slotProcessTimerTimeout()));
+    _moveTimer->setSingleShot(true);
+    QObject::connect(_moveTimer, SIGNAL(timeout()), this, SLOT(slotExpireMoves()));
+    _setupTimer.start();
 
-    _inotify = new INotify(standard_event_mask);
-    slotAddFolderRecursive(root);
-    QObject::connect(_inotify, SIGNAL(notifyEvent(int, int, const QString &)),
-                     SLOT(slotINotifyEvent(int, int, const QString &)));
+#ifdef USE_INOTIFY
+    _inotify = 0;
+    if (_backend == INotifyBackend) {
+        _inotify = new INotify(standard_event_mask);
+        QObject::connect(_inotify, SIGNAL(notifyEvents(const INotifyEventList &)),
+                         SLOT(slotINotifyEvents(const INotifyEventList &)));
+        QObject::connect(_inotify, SIGNAL(wakeUp()), SLOT(slotProcessTimerTimeout()));
+        _budgetTimer = new QTimer(this);
+        _budgetTimer->setSingleShot(true);
+        _budgetTimer->setInterval(POLL_INTERVAL_MSEC);
+        QObject::connect(_budgetTimer, SIGNAL(timeout()), this, SLOT(slotCheckPolledFolders()));
+
+        // the watches are added from the event loop, in slices,
+        // watchReady() is emitted once the whole tree is covered.
+        addFolderRecursive(root, false);
+        return;
+    }
 #endif
-    // do a first synchronization to get changes while
-    // the application was not running
-    setProcessTimer();
+
+    qDebug() << "* Watcher for" << root << "polls every" << POLL_INTERVAL_MSEC << "msec";
+    _poller = new DirectoryPoller(root);
+    _poller->setExcludeMatcher(&_ignores);
+    _pollTimer = new QTimer(this);
+    _pollTimer->setSingleShot(true);
+    _pollTimer->setInterval(POLL_INTERVAL_MSEC);
+    QObject::connect(_pollTimer, SIGNAL(timeout()), this, SLOT(slotPoll()));
+    // the first pass takes the snapshot, the initial
+    // synchronization follows once it is complete.
+    QTimer::singleShot(0, this, SLOT(slotPoll()));
 }
 
 FolderWatcher::~FolderWatcher()
 {
+    delete _poller;
+#ifdef USE_INOTIFY
+    // releases the watches nobody else shares
+    delete _inotify;
+#endif
+}
 
+FolderWatcher::Backend FolderWatcher::backendForPath(const QString &path)
+{
+#ifdef USE_INOTIFY
+    struct statfs sfs;
+    if (::statfs(QFile::encodeName(path).constData(), &sfs) != 0)
+        return INotifyBackend;
+
+    switch (quint32(sfs.f_type)) {
+    case 0x6969:     // NFS
+    case 0x517B:     // SMB
+    case 0xFF534D42: // CIFS
+    case 0xFE534D42: // SMB2
+    case 0x65735546: // FUSE, sshfs and friends
+    case 0x73757245: // Coda
+    case 0x5346414F: // AFS
+        return PollingBackend;
+    default:
+        return INotifyBackend;
+    }
+#else
+    Q_UNUSED(path);
+    return PollingBackend;
+#endif
+}
+
+FolderWatcher::Backend FolderWatcher::backend() const
+{
+    return _backend;
 }
 
 QString FolderWatcher::root() const
@@ -79,24 +213,21 @@ QString FolderWatcher::root() const
 
 void FolderWatcher::setIgnoreListFile( const QString& file )
 {
-    if( file.isEmpty() ) return;
-
-    QFile infile( file );
-    if (!infile.open(QIODevice::ReadOnly | QIODevice::Text))
-        return;
-
-    while (!infile.atEnd()) {
-        QString line = QString::fromLocal8Bit( infile.readLine() ).trimmed();
-        if( !line.startsWith( '#' )) {
-            addIgnore(line);
-        }
-    }
+    _ignores.loadFile( file );
 }
 
 void FolderWatcher::addIgnore(const QString &pattern)
 {
-    if( pattern.isEmpty() ) return;
-    _ignores.append(pattern);
+    _ignores.addPattern(pattern);
+}
+
+bool FolderWatcher::isIgnored(const QString &path) const
+{
+    const QString fileName = path.mid(path.lastIndexOf(QLatin1Char('/')) + 1);
+    if (fileName.startsWith(QLatin1Char('.'))) {
+        return true;
+    }
+    return _ignores.isExcluded(path, fileName);
 }
 
 bool FolderWatcher::eventsEnabled() const
@@ -110,23 +241,28 @@ void FolderWatcher::setEventsEnabled(bool enabled)
     _eventsEnabled = enabled;
     if (_eventsEnabled) {
         // schedule a queue cleanup for accumulated events
-        if ( _pendingPathes.empty() )
+        if ( _pending.isEmpty() )
             return;
-        setProcessTimer();
+        setProcessTimer(false);
     }
     else
     {
         // if we are disabling events, clear any ongoing timer
-        if (_processTimer->isActive())
-            _processTimer->stop();
+        stopProcessTimer();
     }
 }
 
 void FolderWatcher::clearPendingEvents()
 {
-    if (_processTimer->isActive())
-        _processTimer->stop();
-    _pendingPathes.clear();
+    stopProcessTimer();
+    _pending.clear();
+    _moves.clear();
+    _firstPending = 0;
+}
+
+QStringList FolderWatcher::pendingPaths() const
+{
+    return _pending.paths();
 }
 
 int FolderWatcher::eventInterval() const
@@ -139,92 +275,528 @@ void FolderWatcher::setEventInterval(int seconds)
     _eventInterval = seconds;
 }
 
+int FolderWatcher::maxLatency() const
+{
+    return qMax(_maxLatency, _eventInterval);
+}
+
+void FolderWatcher::setMaxLatency(int msecs)
+{
+    _maxLatency = msecs;
+}
+
+int FolderWatcher::settleWindow() const
+{
+    // a burst settles after the event interval. Changes trickling
+    // in slower than that, like a file being downloaded, get twice
+    // their average gap so the sync does not start in between.
+    if (_averageGap < 0)
+        return _eventInterval;
+    return int(qBound(qint64(_eventInterval), 2 * _averageGap,
+                      qint64(qMax(_eventInterval, MAX_SETTLE_WINDOW_MSEC))));
+}
+
+int FolderWatcher::lastLatency() const
+{
+    return _lastLatency;
+}
+
+void FolderWatcher::setPendingLimits(int fanOut, int maxNodes)
+{
+    _pending.setMaxFanOut(fanOut);
+    _pending.setMaxNodes(maxNodes);
+}
+
 QStringList FolderWatcher::folders() const
 {
+    if (_poller)
+        return _poller->directories();
 #ifdef USE_INOTIFY
-    return _inotify->directories();
+    return _inotify->directories() + _budget.directories();
 #else
     return QStringList();
 #endif
 }
 
-void FolderWatcher::slotAddFolderRecursive(const QString &path)
+WatchCoverage FolderWatcher::coverage() const
+{
+    WatchCoverage coverage;
+    coverage.watched = 0;
+    coverage.polled = _budget.count();
+    coverage.unwatched = _unwatched.size();
+    if (_poller)
+        coverage.polled += _poller->directoryCount();
+#ifdef USE_INOTIFY
+    if (_inotify)
+        coverage.watched = _inotify->watchCount();
+#endif
+    return coverage;
+}
+
+bool FolderWatcher::isReady() const
+{
+    return _ready;
+}
+
+int FolderWatcher::setupTime() const
+{
+    return _setupTime;
+}
+
+void FolderWatcher::addFolderRecursive(const QString &path, bool reportContents)
 {
-    int subdirs = 0;
     qDebug() << "(+) Watcher:" << path;
 #ifdef USE_INOTIFY
+    _watchQueue.append(qMakePair(path, reportContents));
+    if (!_watchStepScheduled) {
+        _watchStepScheduled = true;
+        QTimer::singleShot(0, this, SLOT(slotAddPendingWatches()));
+    }
+#else
+    qDebug() << "** Watcher is not compiled in!";
+#endif
+}
+
+void FolderWatcher::slotAddPendingWatches()
+{
+    _watchStepScheduled = false;
+#ifdef USE_INOTIFY
+    bool changed = false;
+    QTime slice;
+    slice.start();
+
+    while (!_watchQueue.isEmpty() && slice.elapsed() < WATCH_SLICE_MSEC) {
+        const QPair<QString, bool> request = _watchQueue.takeFirst();
+        if (addWatch(request.first, request.second))
+            changed = true;
+    }
+
+    if (changed)
+        setProcessTimer();
+
+    if (!_watchQueue.isEmpty()) {
+        emit watchProgress(_watchCount, _watchQueue.size());
+        if (!_watchStepScheduled) {
+            _watchStepScheduled = true;
+            QTimer::singleShot(0, this, SLOT(slotAddPendingWatches()));
+        }
+        return;
+    }
+
+    if (!_ready)
+        setReady();
+#endif
+}
+
+void FolderWatcher::setReady()
+{
+    _ready = true;
+    _setupTime = _setupTimer.elapsed();
+    const WatchCoverage covered = coverage();
+    qDebug() << "* Watcher for" << root() << "is ready after" << _setupTime << "msec,"
+             << covered.watched << "folders watched," << covered.polled << "polled,"
+             << covered.unwatched << "unwatched";
+    emit watchProgress(_watchCount, 0);
+    emit watchReady();
+    // do a first synchronization to get changes while
+    // the application was not running
+    setProcessTimer(false);
+}
+
+void FolderWatcher::slotPoll()
+{
+    QStringList changed;
+    const bool passDone = _poller->poll(&changed, WATCH_SLICE_MSEC);
+
+    bool pending = false;
+    foreach (const QString &path, changed) {
+        if (isIgnored(path))
+            continue;
+        // the poller does not know what happened, only
+        // that the entry appeared or went away.
+        notePending(path, PendingModified);
+        pending = true;
+    }
+    if (pending)
+        setProcessTimer();
+
+    if (!passDone) {
+        QTimer::singleShot(0, this, SLOT(slotPoll()));
+        return;
+    }
 
-    _inotify->addPath(path);
-    QStringList watchedFolders(_inotify->directories());
-    // qDebug() << "currently watching " << watchedFolders;
-    QStringListIterator subfoldersIt(FileUtils::subFoldersList(path, FileUtils::SubFolderRecursive));
-    while (subfoldersIt.hasNext()) {
-        QString subfolder = subfoldersIt.next();
-        // qDebug() << "  (**) subfolder: " << subfolder;
-        QDir folder (subfolder);
-        if (folder.exists() && !watchedFolders.contains(folder.path())) {
-            subdirs++;
-            // check that it does not match the ignore list
-            foreach (QString pattern, _ignores) {
-                QRegExp regexp(pattern);
-                regexp.setPatternSyntax(QRegExp::Wildcard);
-                if ( regexp.exactMatch(folder.path()) ) {
-                    qDebug() << "* Not adding" << folder.path();
-                    continue;
-                }
+    if (!_ready) {
+        _watchCount = _poller->directoryCount();
+        setReady();
+    } else if (!changed.isEmpty()) {
+        qDebug() << "* Poll of" << root() << "found" << changed.size() << "changes,"
+                 << _poller->lastPassListings() << "of" << _poller->directoryCount()
+                 << "folders listed in" << _poller->lastPassTime() << "msec";
+    }
+    _pollTimer->start();
+}
+
+bool FolderWatcher::addWatch(const QString &path, bool reportContents)
+{
+    bool changed = false;
+#ifdef USE_INOTIFY
+    if (!_inotify->contains(path) && !_budget.contains(path)) {
+        bool limitReached = _budget.limitReached();
+        if (!limitReached && _inotify->addPath(path, &limitReached)) {
+            _watchCount++;
+            _unwatched.remove(path);
+        } else if (limitReached) {
+            if (!_budget.limitReached()) {
+                qWarning() << "* Inotify watch limit reached after" << _inotify->watchCount()
+                           << "folders, polling the rest of" << root();
+                _budget.setLimitReached(true);
+            }
+            if (_budget.demote(path) && !_budgetTimer->isActive() && !_budgetPassRunning)
+                _budgetTimer->start();
+        } else {
+            _unwatched.insert(path);
+        }
+    }
 
+    // the folder is listed after the watch is in place, anything
+    // created later shows up as an event. If the folder itself was
+    // just created, whatever is in it by now was missed by the
+    // watch and is reported here.
+    if (!reportContents) {
+        foreach (const QString &subfolder, FileUtils::subFoldersList(path)) {
+            if (isIgnored(subfolder)) {
+                qDebug() << "* Not adding" << subfolder;
+                continue;
             }
-            _inotify->addPath(folder.path());
+            _watchQueue.append(qMakePair(subfolder, false));
+        }
+        return false;
+    }
+
+    NewFolderVisitor visitor;
+    FileUtils::scanDirectory(path, &visitor);
+    for (int i = 0; i < visitor.entries.size(); ++i) {
+        const QString &entryPath = visitor.entries.at(i).first;
+        if (visitor.entries.at(i).second && !isIgnored(entryPath)) {
+            _watchQueue.append(qMakePair(entryPath, true));
+        }
+        if (!isIgnored(entryPath)) {
+            notePending(entryPath, PendingCreated);
+            changed = true;
         }
-        else
-            qDebug() << "    `-> discarded:" << folder.path();
     }
-    if (subdirs >0)
-        qDebug() << "    `-> and" << subdirs << "subdirectories";
+#endif
+    return changed;
+}
+
+void FolderWatcher::unwatch(const QString &path, bool recursive)
+{
+#ifdef USE_INOTIFY
+    if (recursive) {
+        _inotify->removeTree(path);
+        _budget.removeTree(path);
+        const QString prefix = path + QLatin1Char('/');
+        QSet<QString>::iterator it = _unwatched.begin();
+        while (it != _unwatched.end()) {
+            if (*it == path || it->startsWith(prefix))
+                it = _unwatched.erase(it);
+            else
+                ++it;
+        }
+    } else {
+        _inotify->removePath(path);
+        _budget.remove(path);
+        _unwatched.remove(path);
+    }
+    // a watch might have been released, try again
+    _budget.setLimitReached(false);
 #else
-    qDebug() << "** Watcher is not compiled in!";
+    Q_UNUSED(path);
+    Q_UNUSED(recursive);
 #endif
 }
 
-void FolderWatcher::slotINotifyEvent(int mask, int cookie, const QString &path)
+void FolderWatcher::slotCheckPolledFolders()
 {
-    int lastMask = _lastMask;
-    QString lastPath = _lastPath;
+#ifdef USE_INOTIFY
+    if (_budget.count() == 0) {
+        _budgetPassRunning = false;
+        return;
+    }
 
-    _lastMask = mask;
-    _lastPath = path;
+    // one slice of the pass, the rest follows from the event loop
+    QStringList changed;
+    QStringList gone;
+    const bool passDone = _budget.check(&changed, &gone, WATCH_SLICE_MSEC);
+    bool pending = false;
+    foreach (const QString &dir, gone) {
+        if (!isIgnored(dir)) {
+            notePending(dir, PendingDeleted);
+            pending = true;
+        }
+    }
+    foreach (const QString &dir, changed) {
+        // new sub folders get a watch if there is one left,
+        // or are polled as well.
+        foreach (const QString &subfolder, FileUtils::subFoldersList(dir)) {
+            if (!_inotify->contains(subfolder) && !_budget.contains(subfolder)
+                    && !isIgnored(subfolder))
+                addFolderRecursive(subfolder, true);
+        }
+        if (!isIgnored(dir)) {
+            notePending(dir, PendingModified);
+            pending = true;
+        }
+    }
+    if (pending)
+        setProcessTimer();
+
+    if (!passDone) {
+        _budgetPassRunning = true;
+        QTimer::singleShot(0, this, SLOT(slotCheckPolledFolders()));
+        return;
+    }
+    _budgetPassRunning = false;
+    _budgetTimer->start();
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (now - _lastRebalance > REBALANCE_INTERVAL_MSEC && _rebalanceCursor == -1
+            && !_budget.hot(HOT_FOLDER_WINDOW_MSEC).isEmpty()) {
+        _lastRebalance = now;
+        _coldWatches.clear();
+        _rebalanceCursor = 0;
+        slotRebalanceWatches();
+    }
+#endif
+}
 
-    if( ! eventsEnabled() ) return;
+void FolderWatcher::slotRebalanceWatches()
+{
 #ifdef USE_INOTIFY
-    qDebug() << "** Inotify Event " << mask << " on " << path;
-    // cancel close write events that come after create
-    if (lastMask == IN_CREATE && mask == IN_CLOSE_WRITE
-        && lastPath == path ) {
+    // the watched folders which were quiet the longest, found
+    // in slices. Only as many as can be swapped are kept, and
+    // one more as the root is among them but never swapped.
+    const qint64 coldBefore = QDateTime::currentMSecsSinceEpoch() - COLD_FOLDER_AGE_MSEC;
+    QTime slice;
+    slice.start();
+    QList<int> wds;
+    while (_rebalanceCursor != -1 && slice.elapsed() < WATCH_SLICE_MSEC) {
+        wds.clear();
+        _rebalanceCursor = _inotify->walkWatches(_rebalanceCursor, WATCH_WALK_CHUNK, &wds);
+        foreach (int wd, wds) {
+            const qint64 lastEvent = _inotify->lastEvent(wd);
+            if (lastEvent >= coldBefore)
+                continue;
+            _coldWatches.insertMulti(lastEvent, wd);
+            if (_coldWatches.size() > MAX_WATCH_SWAPS + 1)
+                _coldWatches.erase(--_coldWatches.end());
+        }
+    }
+    if (_rebalanceCursor != -1) {
+        QTimer::singleShot(0, this, SLOT(slotRebalanceWatches()));
         return;
     }
 
-    if (IN_IGNORED & mask) {
-        //qDebug() << "IGNORE event";
+    // unwatched while the walk was running if the path is empty
+    QStringList coldDirs;
+    foreach (int wd, _coldWatches) {
+        const QString dir = _inotify->path(wd);
+        if (!dir.isEmpty() && dir != _root)
+            coldDirs.append(dir);
+    }
+    _coldWatches.clear();
+
+    const QStringList hot = _budget.hot(HOT_FOLDER_WINDOW_MSEC);
+    int swaps = 0;
+    foreach (const QString &dir, hot) {
+        if (swaps == coldDirs.size() || swaps == MAX_WATCH_SWAPS)
+            break;
+        const QString coldDir = coldDirs.at(swaps);
+
+        _inotify->removePath(coldDir);
+        if (!_inotify->addPath(dir)) {
+            // give the watch back
+            _inotify->addPath(coldDir);
+            break;
+        }
+        _budget.remove(dir);
+        _budget.demote(coldDir);
+        swaps++;
+    }
+    if (swaps)
+        qDebug() << "* Moved" << swaps << "watches of" << root() << "to busy folders";
+#endif
+}
+
+int FolderWatcher::overflowCount() const
+{
+    return _overflowCount;
+}
+
+int FolderWatcher::lastRecoveryTime() const
+{
+    return _lastRecoveryTime;
+}
+
+void FolderWatcher::setEventQueueCapacity(int events)
+{
+#ifdef USE_INOTIFY
+    if (_inotify)
+        _inotify->setQueueCapacity(events);
+#endif
+}
+
+void FolderWatcher::startOverflowRecovery()
+{
+#ifdef USE_INOTIFY
+    _overflowCount++;
+    // events got lost after the previous complete delivery. If a
+    // recovery is still running, its older watermark is kept.
+    if (_recoveryQueue.isEmpty()) {
+        _cleanSince = _lastDelivery;
+        _recoveryTimer.start();
+    }
+    _recoveryQueue = _inotify->directories();
+    qDebug() << "* Inotify queue overflow for" << root() << ", checking"
+             << _recoveryQueue.size() << "folders changed since" << _cleanSince;
+    if (!_recoveryScheduled) {
+        _recoveryScheduled = true;
+        QTimer::singleShot(0, this, SLOT(slotRecoverOverflow()));
+    }
+#endif
+}
+
+void FolderWatcher::slotRecoverOverflow()
+{
+    _recoveryScheduled = false;
+    bool changed = false;
+    QTime slice;
+    slice.start();
+
+    while (!_recoveryQueue.isEmpty() && slice.elapsed() < WATCH_SLICE_MSEC) {
+        if (rescanIfDirty(_recoveryQueue.takeFirst()))
+            changed = true;
+    }
+
+    if (changed)
+        setProcessTimer();
+    if (!_watchQueue.isEmpty())
+        slotAddPendingWatches();
+
+    if (!_recoveryQueue.isEmpty()) {
+        _recoveryScheduled = true;
+        QTimer::singleShot(0, this, SLOT(slotRecoverOverflow()));
         return;
     }
 
-    if (IN_Q_OVERFLOW & mask) {
-        //qDebug() << "OVERFLOW";
+    _lastRecoveryTime = _recoveryTimer.elapsed();
+    qDebug() << "* Overflow recovery for" << root() << "took" << _lastRecoveryTime << "msec,"
+             << _overflowCount << "overflows so far";
+}
+
+bool FolderWatcher::rescanIfDirty(const QString &dir)
+{
+#ifdef USE_INOTIFY
+    struct stat st;
+    if (::stat(QFile::encodeName(dir).constData(), &st) != 0) {
+        // the folder is gone, its deletion got lost
+        unwatch(dir, false);
+        if (isIgnored(dir))
+            return false;
+        notePending(dir, PendingDeleted);
+        return true;
     }
 
-    if (mask & IN_CREATE) {
+    // the per folder watermark is the time of its latest event
+    const qint64 mtime = qint64(st.st_mtime) * 1000;
+    const bool entriesChanged = mtime + 1000 > _cleanSince;
+    const bool active = _inotify->lastEvent(dir) + OVERFLOW_HOT_WINDOW_MSEC > _cleanSince;
+    if (!entriesChanged && !active)
+        return false;
+
+    // folders which appeared meanwhile get watched, with
+    // everything in them reported.
+    if (entriesChanged) {
+        foreach (const QString &subfolder, FileUtils::subFoldersList(dir)) {
+            if (!_inotify->contains(subfolder) && !isIgnored(subfolder))
+                addFolderRecursive(subfolder, true);
+        }
+    }
+
+    if (isIgnored(dir))
+        return false;
+    // the folder itself is handed to the sync as changed
+    notePending(dir, PendingModified);
+    return true;
+#else
+    return false;
+#endif
+}
+
+#ifdef USE_INOTIFY
+void FolderWatcher::slotINotifyEvents(const INotifyEventList &events)
+{
+    bool changed = false;
+    for (int i = 0; i < events.size(); ++i) {
+        const INotifyEvent &event = events.at(i);
+        if (event.mask & IN_Q_OVERFLOW) {
+            startOverflowRecovery();
+            continue;
+        }
+        if (processINotifyEvent(event.mask, event.cookie, event.path))
+            changed = true;
+    }
+    _lastDelivery = QDateTime::currentMSecsSinceEpoch();
+    if (changed)
+        setProcessTimer();
+    // watch new folders right away to keep the gap small
+    if (!_watchQueue.isEmpty())
+        slotAddPendingWatches();
+}
+#endif
+
+bool FolderWatcher::processINotifyEvent(int mask, int cookie, const QString &path)
+{
+#ifdef USE_INOTIFY
+    // moves are paired by cookie before anything else, the
+    // watches have to follow renamed folders even while
+    // events are disabled.
+    if (mask & IN_MOVED_FROM) {
+        MoveFrom from;
+        from.path = path;
+        from.mask = mask;
+        from.time = QDateTime::currentMSecsSinceEpoch();
+        _movesFrom.insert(cookie, from);
+        if (!_moveTimer->isActive())
+            _moveTimer->start(MOVE_PAIR_WINDOW_MSEC);
+        return false;
+    }
+    if ((mask & IN_MOVED_TO) && _movesFrom.contains(cookie)) {
+        return processMove(_movesFrom.take(cookie), mask, path);
+    }
+#endif
+
+#ifdef USE_INOTIFY
+    // qDebug() << "** Inotify Event " << mask << " on " << path;
+    if (IN_IGNORED & mask) {
+        //qDebug() << "IGNORE event";
+        return false;
+    }
+
+
+    // The kernel flags directories with IN_ISDIR, no need to stat.
+    // something moved in from outside the tree is a create
+    if (mask & (IN_CREATE | IN_MOVED_TO)) {
         //qDebug() << cookie << " CREATE: " << path;
-        if (QFileInfo(path).isDir()) {
-            //setEventsEnabled(false);
-            slotAddFolderRecursive(path);
-            //setEventsEnabled(true);
+        if ((mask & IN_ISDIR) && !isIgnored(path)) {
+            addFolderRecursive(path, true);
         }
     }
     else if (mask & IN_DELETE) {
         //qDebug() << cookie << " DELETE: " << path;
-        if ( QFileInfo(path).isDir() && _inotify->directories().contains(path) ) {
+        if (mask & IN_ISDIR) {
             qDebug() << "(-) Watcher:" << path;
-            _inotify->removePath(path);
+            unwatch(path, false);
         }
     }
     else if (mask & IN_CLOSE_WRITE) {
@@ -237,54 +809,203 @@ void FolderWatcher::slotINotifyEvent(int mask, int cookie, const QString &path)
         //qDebug() << cookie << " OTHER " << mask << " :" << path;
     }
 
-    foreach (QString pattern, _ignores) {
-        QRegExp regexp(pattern);
-        regexp.setPatternSyntax(QRegExp::Wildcard);
+    if (isIgnored(path)) {
+        qDebug() << "* Discarded by ignore pattern: " << path;
+        return false;
+    }
 
-        if (regexp.exactMatch(path)) {
-            qDebug() << "* Discarded by ignore pattern: " << path;
-            return;
+    if (mask & (IN_CREATE | IN_MOVED_TO)) {
+        notePending(path, PendingCreated);
+    } else if (mask & (IN_DELETE | IN_DELETE_SELF | IN_MOVED_FROM)) {
+        notePending(path, PendingDeleted);
+    } else {
+        notePending(path, PendingModified);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool FolderWatcher::processMove(const MoveFrom &from, int mask, const QString &to)
+{
+#ifdef USE_INOTIFY
+    const bool isDir = mask & IN_ISDIR;
+    if (isDir) {
+        if (isIgnored(to)) {
+            unwatch(from.path, true);
+        } else if (!_inotify->renamePath(from.path, to) && !_budget.contains(from.path)) {
+            // the source was not watched, or the target already
+            // is: watch it like a new folder.
+            unwatch(from.path, true);
+            addFolderRecursive(to, true);
+        } else {
+            qDebug() << "(~) Watcher:" << from.path << "->" << to;
+            _budget.rename(from.path, to);
         }
-        QFileInfo fInfo(path);
-        if( regexp.exactMatch(fInfo.fileName())) {
-            qDebug() << "* Discarded by ignore pattern:" << path;
-            return;
+    }
+
+    const bool fromIgnored = isIgnored(from.path);
+    const bool toIgnored = isIgnored(to);
+
+    // editors save by writing a temporary file and renaming it
+    // over the original, that is a modification of the original.
+    // The temporary file is dropped again below.
+    const bool atomicSave = !isDir && !toIgnored
+            && (fromIgnored || _pending.change(from.path) == PendingTree::Created);
+    if (!fromIgnored)
+        notePending(from.path, PendingDeleted);
+    if (!toIgnored)
+        notePending(to, atomicSave ? PendingModified : PendingCreated);
+
+    // a move between an ignored and a watched name is only
+    // a delete or a create for the sync.
+    if (!fromIgnored && !toIgnored && !atomicSave) {
+        PathMove move;
+        move.from = from.path;
+        move.to = to;
+        move.isDir = isDir;
+        _moves.append(move);
+    }
+    return !fromIgnored || !toIgnored;
+#else
+    return false;
+#endif
+}
+
+void FolderWatcher::slotExpireMoves()
+{
+#ifdef USE_INOTIFY
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    qint64 nextExpiry = -1;
+    bool changed = false;
+
+    QHash<int, MoveFrom>::iterator it = _movesFrom.begin();
+    while (it != _movesFrom.end()) {
+        const qint64 expiry = it.value().time + MOVE_PAIR_WINDOW_MSEC;
+        if (expiry > now) {
+            if (nextExpiry == -1 || expiry < nextExpiry)
+                nextExpiry = expiry;
+            ++it;
+            continue;
         }
-        if( fInfo.isHidden() ) {
-            qDebug() << "* Discarded as is hidden!";
-            return;
+
+        // moved out of the tree, that is a delete
+        const MoveFrom from = it.value();
+        it = _movesFrom.erase(it);
+        if (from.mask & IN_ISDIR) {
+            qDebug() << "(-) Watcher:" << from.path;
+            unwatch(from.path, true);
+        }
+        if (!isIgnored(from.path)) {
+            notePending(from.path, PendingDeleted);
+            changed = true;
         }
     }
 
-    if( !_pendingPathes.contains( path )) {
-        _pendingPathes[path] = 0;
-    }
-    _pendingPathes[path] = _pendingPathes[path]+mask;
+    if (nextExpiry != -1)
+        _moveTimer->start(int(nextExpiry - now));
+    if (changed)
+        setProcessTimer();
 #endif
-    setProcessTimer();
 }
 
 void FolderWatcher::slotProcessTimerTimeout()
 {
     qDebug() << "* Processing of event queue for" << root();
 
-    if (!_pendingPathes.empty() || !_initialSyncDone) {
-        QStringList notifyPaths = _pendingPathes.keys();
-        _pendingPathes.clear();
+    if (_firstPending) {
+        _lastLatency = int(QDateTime::currentMSecsSinceEpoch() - _firstPending);
+        _firstPending = 0;
+        qDebug() << "  * Changes of" << root() << "waited" << _lastLatency << "msec,"
+                 << "settle window" << settleWindow() << "msec";
+    }
+
+    if (!_pending.isEmpty() || !_initialSyncDone) {
+        // collapsed folders come as one path
+        QStringList notifyPaths = _pending.paths();
         //qDebug() << lastEventTime << eventTime;
         qDebug() << "  * Notify" << notifyPaths.size() << "changed items for" << root();
+        // a move only holds if its source is still gone and its
+        // target still there, vim for example moves the original
+        // to a backup name and deletes that after writing.
+        PathMoveList moves;
+        foreach (const PathMove &move, _moves) {
+            if (_pending.change(move.from) == PendingTree::Deleted
+                    && _pending.change(move.to) == PendingTree::Created)
+                moves.append(move);
+        }
+        _moves.clear();
+        _pending.clear();
+        // the next batch finds its own pace
+        _averageGap = -1;
+        if (!moves.isEmpty()) {
+            qDebug() << "  *" << moves.size() << "of them were moved";
+            emit pathsMoved(moves);
+        }
         emit folderChanged(notifyPaths);
         _initialSyncDone = true;
     }
 }
 
-void FolderWatcher::setProcessTimer()
+void FolderWatcher::notePending(const QString &path, PendingChange change)
 {
-    if (!_processTimer->isActive()) {
-        qDebug() << "* Pending events for" << root() << "will be processed after events stop for" << eventInterval() << "seconds (" << QTime::currentTime().addSecs(eventInterval()).toString("HH:mm:ss") << ")." << _pendingPathes.size() << "events until now )";
+    _pending.note(path, PendingTree::Change(change));
+}
+
+void FolderWatcher::setProcessTimer(bool newChange)
+{
+    // while events are disabled the changes are only
+    // collected, setEventsEnabled() starts the timer.
+    if (!_eventsEnabled)
+        return;
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (_firstPending == 0) {
+        _firstPending = now;
+        _lastPending = now;
+    } else if (newChange) {
+        // smoothed gap between changes of the same batch
+        const qint64 gap = now - _lastPending;
+        _averageGap = _averageGap < 0 ? gap : (3 * _averageGap + gap) / 4;
+        _lastPending = now;
+    }
+
+    // the timer restarts with every change, but never runs
+    // past the deadline of the first pending one.
+    const int window = settleWindow();
+    const qint64 deadline = _firstPending + maxLatency();
+    const int delay = int(qBound(qint64(0), deadline - now, qint64(window)));
+
+    if (!isProcessTimerActive()) {
+        qDebug() << "* Pending events for" << root() << "will be processed after events stop for" << delay << "msec (" << QTime::currentTime().addMSecs(delay).toString("HH:mm:ss") << ")." << _pending.nodeCount() << "pending paths until now )";
+    }
+#ifdef USE_INOTIFY
+    // without the inotify thread the timer has to do
+    if (_inotify && _inotify->wakeUpIn(delay)) {
+        _processTimer->stop();
+        return;
     }
-    _processTimer->start(eventInterval());
+#endif
+    _processTimer->start(delay);
 }
 
+void FolderWatcher::stopProcessTimer()
+{
+#ifdef USE_INOTIFY
+    if (_inotify)
+        _inotify->cancelWakeUp();
+#endif
+    _processTimer->stop();
 }
 
+bool FolderWatcher::isProcessTimerActive() const
+{
+#ifdef USE_INOTIFY
+    if (_inotify && _inotify->wakeUpPending())
+        return true;
+#endif
+    return _processTimer->isActive();
+}
+
+}
@@ -16,21 +16,54 @@
 #define MIRALL_FOLDERWATCHER_H
 
 #include <QList>
+#include <QMap>
 #include <QObject>
+#include <QPair>
 #include <QString>
 #include <QStringList>
 #include <QTime>
 #include <QHash>
+#include <QSet>
 
-#include "mirall/folder.h"
-
-class QTimer;
+#include "mirall/excludematcher.h"
 #ifdef USE_INOTIFY
-class INotify;
+#include "mirall/inotify.h"
 #endif
+#include "mirall/pendingtree.h"
+#include "mirall/watchbudget.h"
+
+class QTimer;
 
 namespace Mirall {
 
+class DirectoryPoller;
+
+/**
+ * A file or folder that was renamed or moved inside
+ * the watched tree, paths are absolute.
+ */
+struct PathMove
+{
+    QString from;
+    QString to;
+    bool isDir;
+};
+
+typedef QList<PathMove> PathMoveList;
+
+/**
+ * How the folders below a watched root are covered
+ */
+struct WatchCoverage
+{
+    // folders with an inotify watch
+    int watched;
+    // folders checked by polling their mtime
+    int polled;
+    // folders which could be neither, unreadable ones
+    int unwatched;
+};
+
 /**
  * Watches a folder and sub folders for changes
  *
@@ -44,6 +77,13 @@ class FolderWatcher : public QObject
 {
 Q_OBJECT
 public:
+    enum Backend {
+        // kernel notifications, local file systems on Linux
+        INotifyBackend,
+        // directory snapshots compared every few seconds
+        PollingBackend
+    };
+
     /**
      * @param root Path of the root of the folder
      */
@@ -60,6 +100,55 @@ public:
      */
     QString root() const;
 
+    /**
+     * How changes below root() are found
+     */
+    Backend backend() const;
+
+    /**
+     * The backend which works for path: inotify does not see
+     * changes made by other clients of network file systems,
+     * those and all folders on platforms without inotify are
+     * polled.
+     */
+    static Backend backendForPath(const QString &path);
+
+    /**
+     * Number of watched, polled and unwatched folders. Once the
+     * inotify watch limit is reached, the remaining folders are
+     * polled and the watches go to the busiest folders.
+     */
+    WatchCoverage coverage() const;
+
+    /**
+     * True once all folders below root() are watched
+     */
+    bool isReady() const;
+
+    /**
+     * Milliseconds it took to watch all folders, -1 while
+     * the watcher is not ready yet.
+     */
+    int setupTime() const;
+
+    /**
+     * Number of event queue overflows so far
+     */
+    int overflowCount() const;
+
+    /**
+     * Milliseconds the last overflow recovery took, -1 if
+     * there was none yet.
+     */
+    int lastRecoveryTime() const;
+
+    /**
+     * Number of events which can wait for processing before
+     * the queue overflows, see INotify::setQueueCapacity().
+     * Only call this right after construction.
+     */
+    void setEventQueueCapacity(int events);
+
     /**
       * Set a file name to load a file with ignore patterns.
       */
@@ -73,6 +162,12 @@ public:
      */
     void addIgnore(const QString &pattern);
 
+    /**
+     * True if the path matches one of the ignore patterns
+     * or is a hidden file
+     */
+    bool isIgnored(const QString &path) const;
+
     /**
      * If true, folderChanged() events are sent
      * at least as often as eventInterval() seconds.
@@ -83,6 +178,8 @@ public:
      * Enabled or disables folderChanged() events.
      * If disabled, events are accumulated and emptied
      * the next time a folderChanged() event happens.
+     * The accumulated changes are bounded like all
+     * pending ones, see setPendingLimits().
      */
     void setEventsEnabled(bool enabled);
 
@@ -91,6 +188,12 @@ public:
      */
     void clearPendingEvents();
 
+    /**
+     * The changes not notified yet, collected while events
+     * were disabled or waiting for the settle window.
+     */
+    QStringList pendingPaths() const;
+
     /**
      * The minimum amounts of seconds that will separate
      * folderChanged() intervals
@@ -103,44 +206,176 @@ public:
      */
     void setEventInterval(int seconds);
 
+    /**
+     * Upper bound in msecs between the first pending change and
+     * the folderChanged() notification, even if changes keep
+     * coming in. Never shorter than eventInterval().
+     */
+    int maxLatency() const;
+    void setMaxLatency(int msecs);
+
+    /**
+     * Msecs the settle window currently has, it grows beyond
+     * eventInterval() while changes trickle in slowly.
+     */
+    int settleWindow() const;
+
+    /**
+     * Msecs between the first change and the folderChanged()
+     * notification for the last batch, -1 if none yet.
+     */
+    int lastLatency() const;
+
+    /**
+     * A folder with more than fanOut changed children is
+     * reported as a whole, and at most maxNodes pending paths
+     * are kept before the busiest subtree is reported as a
+     * whole. See PendingTree.
+     */
+    void setPendingLimits(int fanOut, int maxNodes);
+
 signals:
     /**
      * Emitted when one of the paths is changed
      */
     void folderChanged(const QStringList &pathList);
 
+    /**
+     * Emitted right before folderChanged() if some of the
+     * changed paths belong to moves. Both sides of a move
+     * are part of the path list of folderChanged() as well.
+     */
+    void pathsMoved(const PathMoveList &moves);
+
+    /**
+     * Emitted while the watches are set up, pending is the
+     * number of folders which are known but not watched yet.
+     */
+    void watchProgress(int watched, int pending);
+
+    /**
+     * Emitted once all folders below root() are watched
+     */
+    void watchReady();
+
 protected:
-    void setProcessTimer();
+    // what happened to a pending path since the last
+    // notification, after coalescing all its events
+    enum PendingChange {
+        PendingCreated = PendingTree::Created,
+        PendingModified = PendingTree::Modified,
+        PendingDeleted = PendingTree::Deleted
+    };
+
+    // newChange is false if nothing changed since the last
+    // call, only the timer is started then.
+    void setProcessTimer(bool newChange = true);
+    // the process timer runs in the inotify thread when there
+    // is one, the polling backend uses a QTimer
+    void stopProcessTimer();
+    bool isProcessTimerActive() const;
+    // merges change into the state of the path, a path created
+    // and deleted again is dropped
+    void notePending(const QString &path, PendingChange change);
+    // returns true if the path was added to the pending ones
+    bool processINotifyEvent(int mask, int cookie, const QString &path);
+    struct MoveFrom {
+        QString path;
+        int mask;
+        qint64 time;
+    };
+    bool processMove(const MoveFrom &from, int mask, const QString &to);
+    // queues path and its subfolders for watching, if reportContents
+    // is true, everything found in them is a pending change.
+    void addFolderRecursive(const QString &path, bool reportContents);
+    bool addWatch(const QString &path, bool reportContents);
+    // events were lost, find the folders which might have changed
+    void startOverflowRecovery();
+    bool rescanIfDirty(const QString &dir);
+    void setReady();
+    // drops the watch or polling of path, and of everything
+    // below if recursive is true
+    void unwatch(const QString &path, bool recursive);
 
 protected slots:
-    void slotINotifyEvent(int mask, int cookie, const QString &path);
-    void slotAddFolderRecursive(const QString &path);
+#ifdef USE_INOTIFY
+    void slotINotifyEvents(const INotifyEventList &events);
+#endif
+    void slotAddPendingWatches();
+    void slotRecoverOverflow();
+    // moves whose other half did not show up in time
+    void slotExpireMoves();
+    void slotPoll();
+    void slotCheckPolledFolders();
+    // gives watches of cold folders to busy polled ones
+    void slotRebalanceWatches();
     // called when the manually process timer triggers
     void slotProcessTimerTimeout();
 
 private:
     bool _eventsEnabled;
     int _eventInterval;
+    Backend _backend;
 #ifdef USE_INOTIFY
     INotify *_inotify;
 #endif
+    DirectoryPoller *_poller;
+    QTimer *_pollTimer;
     QString _root;
-    // paths pending to notified
-    // QStringList _pendingPaths;
-    QHash<QString, int> _pendingPathes;
+    // paths pending to notified, with their PendingChange
+    PendingTree _pending;
 
+    // only used by the polling backend
     QTimer *_processTimer;
+    // debouncing, times in msecs since epoch
+    int _maxLatency;
+    qint64 _firstPending;
+    qint64 _lastPending;
+    qint64 _averageGap;
+    int _lastLatency;
+
+    // IN_MOVED_FROM halves waiting for their IN_MOVED_TO, by cookie
+    QHash<int, MoveFrom> _movesFrom;
+    QTimer *_moveTimer;
+    PathMoveList _moves;
 
-    // to cancel events that belong to the same action
-    int _lastMask;
-    QString _lastPath;
-    QStringList _ignores;
+    ExcludeMatcher _ignores;
 
     // for the initial synchronization, without
     // any file changed
     bool _initialSyncDone;
+
+    // folders waiting to be watched
+    QList<QPair<QString, bool> > _watchQueue;
+    bool _watchStepScheduled;
+    bool _ready;
+    int _watchCount;
+    QTime _setupTimer;
+    int _setupTime;
+
+    // overflow recovery
+    qint64 _lastDelivery;
+    QStringList _recoveryQueue;
+    bool _recoveryScheduled;
+    qint64 _cleanSince;
+    QTime _recoveryTimer;
+    int _overflowCount;
+    int _lastRecoveryTime;
+
+    // folders left without a watch
+    WatchBudget _budget;
+    QSet<QString> _unwatched;
+    QTimer *_budgetTimer;
+    bool _budgetPassRunning;
+    qint64 _lastRebalance;
+    // where the walk for cold watches continues, -1 if idle
+    int _rebalanceCursor;
+    // watch descriptors by the time of their last event
+    QMap<qint64, int> _coldWatches;
 };
 
 }
 
+Q_DECLARE_METATYPE(Mirall::PathMoveList)
+
 #endif
@@ -19,180 +19,753 @@
 #ifdef USE_INOTIFY
 #include <sys/inotify.h>
 #endif
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <cerrno>
+#include <cstring>
 #include <unistd.h>
+#include <QDateTime>
 #include <QDebug>
+#include <QFile>
+#include <QMutexLocker>
 #include <QStringList>
+#include <QVarLengthArray>
 
 #include "inotify.h"
 
-// Buffer Size for read() buffer
-#define DEFAULT_READ_BUFFERSIZE 2048
+// Buffer Size for read() buffer, large enough to drain
+// a burst of events with a single read()
+#define DEFAULT_READ_BUFFERSIZE 65536
+// Number of events that can wait for delivery per INotify
+#define DEFAULT_QUEUE_CAPACITY 1024
 
 namespace Mirall {
 // Allocate space for static members of class.
-int INotify::s_fd;
+int INotify::s_fd = -1;
 INotify::INotifyThread* INotify::s_thread;
+int INotify::s_startupTime = -1;
+int INotify::s_shutdownTime = -1;
+WatchTable INotify::s_watches;
+QHash<int, QList<INotify*> > INotify::s_interest;
 
 //INotify::INotify(int wd) : _wd(wd)
 //{
 //}
 
-INotify::INotify(int mask) : _mask(mask)
+INotify::INotify(int mask)
+    : _mask(mask),
+      _wakeUpAt(0),
+      _queue(0),
+      _queueCapacity(0),
+      _queueHead(0),
+      _queueTail(0),
+      _overflow(0),
+      _deliveryPending(0),
+      _eventCount(0),
+      _batchCount(0),
+      _largestBatch(0),
+      _eventsPerSecond(0),
+      _rateWindowEvents(0)
 {
+    setQueueCapacity(DEFAULT_QUEUE_CAPACITY);
 }
 
 INotify::~INotify()
 {
-    // Unregister from iNotifier thread.
-    s_thread->unregisterForNotification(this);
+    // Unregister from iNotifier thread, the watches nobody
+    // else is interested in are removed.
+    foreach (int wd, _wds.toList())
+        release(wd, false);
+    if (s_thread)
+        s_thread->unregisterAll(this);
 
-    // Remove all inotify watchs.
-    QString key;
-    foreach (key, _wds.keys())
-        inotify_rm_watch(s_fd, _wds.value(key));
+    delete[] _queue;
 }
 
-void INotify::addPath(const QString &path)
+void INotify::setQueueCapacity(int events)
+{
+    // one slot always stays empty to tell a full queue from an empty one
+    delete[] _queue;
+    _queueCapacity = qMax(events, 1) + 1;
+    _queue = new RawEvent[_queueCapacity];
+    _queueHead = 0;
+    _queueTail = 0;
+    _batch.reserve(_queueCapacity);
+}
+
+int INotify::queueCapacity() const
+{
+    return _queueCapacity - 1;
+}
+
+bool INotify::addPath(const QString &path, bool *limitReached)
 {
     // Add an inotify watch.
-    path.toAscii().constData();
+    int wd = inotify_add_watch(s_fd, QFile::encodeName(path).constData(), _mask);
+    if (wd == -1) {
+        const int error = errno;
+        if (limitReached)
+            *limitReached = (error == ENOSPC);
+        if (error != ENOSPC)
+            qWarning() << "inotify_add_watch failed for" << path << ":" << strerror(error);
+        return false;
+    }
+    if (limitReached)
+        *limitReached = false;
+    s_watches.insert(path, wd);
+
+    if (!_wds.contains(wd)) {
+        _wds.insert(wd);
+        s_interest[wd].append(this);
+        // Register for iNotifycation from iNotifier thread.
+        s_thread->registerForNotification(this, wd);
+    }
+    return true;
+}
+
+void INotify::release(int wd, bool dropped)
+{
+    if (!_wds.remove(wd))
+        return;
+    if (s_thread)
+        s_thread->unregisterForNotification(this, wd);
 
-    int wd = inotify_add_watch(s_fd, path.toAscii().constData(), _mask);
-    _wds[path] = wd;
+    QHash<int, QList<INotify*> >::iterator it = s_interest.find(wd);
+    if (it == s_interest.end())
+        return;
+    it.value().removeAll(this);
+    if (!it.value().isEmpty())
+        return;
 
-    // Register for iNotifycation from iNotifier thread.
-    s_thread->registerForNotification(this, wd);
+    s_interest.erase(it);
+    s_watches.removeDescriptor(wd);
+    if (!dropped)
+        inotify_rm_watch(s_fd, wd);
 }
 
 void INotify::removePath(const QString &path)
 {
     // Remove the inotify watch.
-    inotify_rm_watch(s_fd, _wds[path]);
-    _wds.remove(path);
+    const int wd = s_watches.descriptor(path);
+    if (wd != -1)
+        release(wd, false);
+}
+
+void INotify::removeTree(const QString &path)
+{
+    foreach (int wd, s_watches.descriptorsBelow(path))
+        release(wd, false);
+}
+
+bool INotify::renamePath(const QString &from, const QString &to)
+{
+    if (s_watches.rename(from, to))
+        return true;
+    // another instance watching the same folder followed
+    // the rename already
+    return !s_watches.contains(from) && contains(to);
 }
 
 QStringList INotify::directories() const
 {
-    return _wds.keys();
+    QStringList list;
+    foreach (int wd, _wds)
+        list.append(s_watches.path(wd));
+    return list;
 }
 
-void
-INotify::INotifyThread::unregisterForNotification(INotify* notifier)
+int INotify::watchCount() const
+{
+    return _wds.size();
+}
+
+int INotify::kernelWatchCount()
 {
-    //_map.remove(notifier->_wd);
-    QMap<int, INotify*>::iterator it;
-    for (it = _map.begin(); it != _map.end(); ++it) {
-        if (it.value() == notifier)
-            _map.remove(it.key());
+    return s_watches.count();
+}
+
+bool INotify::contains(const QString &path) const
+{
+    return _wds.contains(s_watches.descriptor(path));
+}
+
+qint64 INotify::lastEvent(const QString &path) const
+{
+    if (!contains(path))
+        return 0;
+    return s_watches.lastEvent(path);
+}
+
+qint64 INotify::lastEvent(int wd) const
+{
+    if (!_wds.contains(wd))
+        return 0;
+    return s_watches.lastEvent(wd);
+}
+
+int INotify::walkWatches(int cursor, int count, QList<int> *wds) const
+{
+    QList<int> chunk;
+    cursor = s_watches.walk(cursor, count, &chunk);
+    // the table is shared with the other instances
+    foreach (int wd, chunk) {
+        if (_wds.contains(wd))
+            wds->append(wd);
     }
+    return cursor;
+}
+
+QString INotify::path(int wd) const
+{
+    if (!_wds.contains(wd))
+        return QString();
+    return s_watches.path(wd);
+}
+
+void
+INotify::INotifyThread::unregisterForNotification(INotify* notifier, int wd)
+{
+    // a stale snapshot entry is harmless as long as the notifier
+    // lives, it ignores descriptors it is not interested in.
+    QMutexLocker lock(&_lock);
+    Registrations::iterator it = _registrations.find(wd);
+    if (it == _registrations.end())
+        return;
+    const int i = it.value().indexOf(notifier);
+    if (i == -1)
+        return;
+    it.value().remove(i);
+    if (it.value().isEmpty())
+        _registrations.erase(it);
+    _unpublished++;
 }
 
 void
 INotify::INotifyThread::registerForNotification(INotify* notifier, int wd)
 {
-    _map[wd] = notifier;
+    QMutexLocker lock(&_lock);
+    _registrations[wd].append(notifier);
+    _unpublished++;
 }
 
 void
-INotify::fireEvent(int mask, int cookie, int wd, char* name)
+INotify::INotifyThread::unregisterAll(INotify* notifier)
 {
-    //qDebug() << "****" << name;
-    QStringList paths(_wds.keys(wd));
-    foreach (QString path, paths)
-        emit notifyEvent(mask, cookie, path + "/" + QString::fromUtf8(name));
+    Registrations *old;
+    {
+        QMutexLocker lock(&_lock);
+        Registrations::iterator it = _registrations.begin();
+        while (it != _registrations.end()) {
+            const int i = it.value().indexOf(notifier);
+            if (i != -1)
+                it.value().remove(i);
+            if (it.value().isEmpty())
+                it = _registrations.erase(it);
+            else
+                ++it;
+        }
+        _wakeUps.remove(notifier);
+        old = _snapshot.fetchAndStoreOrdered(new Registrations(_registrations));
+        _unpublished = 0;
+    }
+
+    // the thread might still read the old snapshot, wait until
+    // it is done with the events it is working on.
+    const int sequence = _readerSequence.fetchAndAddOrdered(0);
+    if (sequence & 1) {
+        while (_readerSequence.fetchAndAddOrdered(0) == sequence)
+            yieldCurrentThread();
+    }
+    delete old;
+}
+
+QVector<INotify*>
+INotify::INotifyThread::lookupMissed(int wd, const Registrations **snapshot)
+{
+    QMutexLocker lock(&_lock);
+    // a new snapshot is cheap, the hash is implicitly shared. The
+    // next change detaches it in the main thread, so that happens
+    // only once a good part of the registrations changed.
+    if (_unpublished >= qMax(16, _registrations.size() / 8)) {
+        Registrations *fresh = new Registrations(_registrations);
+        // only this thread reads snapshots, the one replaced here
+        // is not used anywhere else.
+        delete _snapshot.fetchAndStoreOrdered(fresh);
+        *snapshot = fresh;
+        _unpublished = 0;
+    }
+    return _registrations.value(wd);
+}
+
+bool
+INotify::enqueue(const struct inotify_event *event)
+{
+    // only this thread writes the tail
+    const int tail = _queueTail;
+    const int next = (tail + 1) % _queueCapacity;
+    if (next == _queueHead.fetchAndAddAcquire(0)) {
+        _overflow.fetchAndStoreRelaxed(1);
+        return false;
+    }
+
+    RawEvent &raw = _queue[tail];
+    raw.wd = event->wd;
+    raw.mask = event->mask;
+    raw.cookie = event->cookie;
+    // the kernel pads the name with zeros, len includes the padding
+    const size_t len = qMin<size_t>(event->len, NAME_MAX);
+    if (len > 0)
+        memcpy(raw.name, event->name, len);
+    raw.name[len] = '\0';
+
+    _queueTail.fetchAndStoreRelease(next);
+    return true;
+}
+
+void
+INotify::slotDeliverEvents()
+{
+    // events queued from now on need another delivery
+    _deliveryPending.fetchAndStoreOrdered(0);
+
+    const int tail = _queueTail.fetchAndAddAcquire(0);
+    int head = _queueHead;
+
+    _batch.resize(0);
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    // events of one directory usually come in a row
+    int lastWd = -1;
+    QString path;
+    while (head != tail) {
+        const RawEvent &raw = _queue[head];
+        head = (head + 1) % _queueCapacity;
+        // the snapshot can still list descriptors this instance
+        // released or never had
+        if (!_wds.contains(raw.wd))
+            continue;
+        //qDebug() << "****" << raw.name;
+        if (raw.wd != lastWd) {
+            path = s_watches.path(raw.wd);
+            s_watches.touch(raw.wd, now);
+            lastWd = raw.wd;
+        }
+        if (raw.mask & IN_IGNORED) {
+            // the kernel dropped the watch, the descriptor can be
+            // reused once every interested instance saw this
+            release(raw.wd, true);
+            lastWd = -1;
+        }
+        if (path.isEmpty())
+            continue;
+
+        INotifyEvent event;
+        event.mask = raw.mask;
+        event.cookie = raw.cookie;
+        event.path = raw.name[0] ? path + "/" + QString::fromUtf8(raw.name) : path;
+        _batch.append(event);
+    }
+    _queueHead.fetchAndStoreRelease(head);
+
+    if (_overflow.fetchAndStoreOrdered(0)) {
+        INotifyEvent event;
+        event.mask = IN_Q_OVERFLOW;
+        event.cookie = 0;
+        _batch.append(event);
+    }
+
+    if (_batch.isEmpty())
+        return;
+
+    _eventCount += _batch.size();
+    _batchCount++;
+    _largestBatch = qMax(_largestBatch, _batch.size());
+    if (!_rateWindow.isValid() || _rateWindow.elapsed() >= 1000) {
+        if (_rateWindow.isValid())
+            _eventsPerSecond = _rateWindowEvents * 1000 / qMax(_rateWindow.elapsed(), 1);
+        _rateWindow.start();
+        _rateWindowEvents = 0;
+    }
+    _rateWindowEvents += _batch.size();
+
+    emit notifyEvents(_batch);
+}
+
+qint64 INotify::eventCount() const
+{
+    return _eventCount;
+}
+
+qint64 INotify::batchCount() const
+{
+    return _batchCount;
+}
+
+int INotify::largestBatch() const
+{
+    return _largestBatch;
+}
+
+int INotify::eventsPerSecond() const
+{
+    return _eventsPerSecond;
 }
 
 void
 INotify::initialize()
 {
-    s_fd = inotify_init();
+    QTime startup;
+    startup.start();
+    // non blocking, the thread drains it after epoll reported it
+    s_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (s_fd == -1)
+        qWarning() << "inotify_init1 failed:" << strerror(errno);
     s_thread = new INotifyThread(s_fd);
     s_thread->start();
+    s_thread->waitUntilStarted();
+    s_startupTime = startup.elapsed();
+    qDebug() << "* inotify thread started in" << s_startupTime << "msec";
 }
 
 void
 INotify::cleanup()
 {
+    QTime shutdown;
+    shutdown.start();
+    if (s_thread) {
+        s_thread->stop();
+        s_thread->wait();
+        delete s_thread;
+        s_thread = 0;
+    }
     close(s_fd);
-    s_thread->terminate();
-    s_thread->wait(3000);
-    delete s_thread;
+    s_fd = -1;
+    // the descriptors died with the fd, a later initialize()
+    // starts from scratch. Instances still around forget theirs.
+    foreach (const QList<INotify*> &notifiers, s_interest) {
+        foreach (INotify *notifier, notifiers)
+            notifier->_wds.clear();
+    }
+    s_interest.clear();
+    s_watches.clear();
+    s_shutdownTime = shutdown.elapsed();
+    qDebug() << "* inotify thread stopped in" << s_shutdownTime << "msec";
+}
+
+int INotify::startupTime()
+{
+    return s_startupTime;
+}
+
+int INotify::shutdownTime()
+{
+    return s_shutdownTime;
+}
+
+bool INotify::wakeUpIn(int msecs)
+{
+    if (!s_thread || !s_thread->isValid() || !s_thread->isRunning()) {
+        _wakeUpAt = 0;
+        return false;
+    }
+    _wakeUpAt = QDateTime::currentMSecsSinceEpoch() + qMax(msecs, 0);
+    s_thread->scheduleWakeUp(this, _wakeUpAt);
+    return true;
+}
+
+void INotify::cancelWakeUp()
+{
+    if (_wakeUpAt == 0)
+        return;
+    _wakeUpAt = 0;
+    if (s_thread)
+        s_thread->scheduleWakeUp(this, 0);
 }
 
-INotify::INotifyThread::INotifyThread(int fd) : _fd(fd)
+bool INotify::wakeUpPending() const
+{
+    return _wakeUpAt != 0;
+}
+
+void INotify::slotWakeUp()
+{
+    // the wake up was cancelled or moved to a later time
+    // after the thread queued it
+    if (_wakeUpAt == 0 || QDateTime::currentMSecsSinceEpoch() < _wakeUpAt)
+        return;
+    _wakeUpAt = 0;
+    emit wakeUp();
+}
+
+INotify::INotifyThread::INotifyThread(int fd)
+    : _fd(fd),
+      _epollFd(-1),
+      _wakeFd(-1),
+      _stopping(0),
+      _unpublished(0),
+      _snapshot(new Registrations),
+      _readerSequence(0),
+      _sleepUntil(-1)
 {
     _buffer_size = DEFAULT_READ_BUFFERSIZE;
     _buffer = (char *) malloc(_buffer_size);
+
+    _epollFd = epoll_create1(EPOLL_CLOEXEC);
+    _wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_epollFd == -1 || _wakeFd == -1) {
+        qWarning() << "inotify thread can not wait for events:" << strerror(errno);
+        return;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = _wakeFd;
+    epoll_ctl(_epollFd, EPOLL_CTL_ADD, _wakeFd, &ev);
+    if (_fd != -1) {
+        ev.data.fd = _fd;
+        epoll_ctl(_epollFd, EPOLL_CTL_ADD, _fd, &ev);
+    }
 }
 
 INotify::INotifyThread::~INotifyThread()
 {
+    if (_epollFd != -1)
+        close(_epollFd);
+    if (_wakeFd != -1)
+        close(_wakeFd);
+    delete _snapshot.fetchAndStoreOrdered(0);
     free(_buffer);
 }
 
+bool
+INotify::INotifyThread::isValid() const
+{
+    return _epollFd != -1 && _wakeFd != -1;
+}
+
+void
+INotify::INotifyThread::waitUntilStarted()
+{
+    _started.acquire();
+}
+
+void
+INotify::INotifyThread::wake()
+{
+    const quint64 one = 1;
+    if (write(_wakeFd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN)
+        qWarning() << "can not wake the inotify thread:" << strerror(errno);
+}
+
+void
+INotify::INotifyThread::stop()
+{
+    _stopping.fetchAndStoreOrdered(1);
+    wake();
+}
+
+void
+INotify::INotifyThread::scheduleWakeUp(INotify* notifier, qint64 at)
+{
+    QMutexLocker lock(&_lock);
+    if (at == 0) {
+        // waking up for nothing is harmless, the thread
+        // is left alone.
+        _wakeUps.remove(notifier);
+        return;
+    }
+    _wakeUps.insert(notifier, at);
+    if (_sleepUntil == -1 || at < _sleepUntil)
+        wake();
+}
+
+int
+INotify::INotifyThread::nextTimeout()
+{
+    QMutexLocker lock(&_lock);
+    if (_wakeUps.isEmpty()) {
+        _sleepUntil = -1;
+        return -1;
+    }
+    qint64 next = -1;
+    QHash<INotify*, qint64>::const_iterator it;
+    for (it = _wakeUps.constBegin(); it != _wakeUps.constEnd(); ++it) {
+        if (next == -1 || it.value() < next)
+            next = it.value();
+    }
+    _sleepUntil = next;
+    return int(qMax(next - QDateTime::currentMSecsSinceEpoch(), qint64(0)));
+}
+
+void
+INotify::INotifyThread::fireWakeUps()
+{
+    QMutexLocker lock(&_lock);
+    if (_wakeUps.isEmpty())
+        return;
+    // posted under the lock, unregisterAll() can not
+    // delete the notifier meanwhile
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QHash<INotify*, qint64>::iterator it = _wakeUps.begin();
+    while (it != _wakeUps.end()) {
+        if (it.value() <= now) {
+            QMetaObject::invokeMethod(it.key(), "slotWakeUp", Qt::QueuedConnection);
+            it = _wakeUps.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
 // Thread routine
 void
 INotify::INotifyThread::run()
 {
-    int len;
-    struct inotify_event* event;
-    INotify* n = NULL;
-    int i;
-    int error;
+    if (!isValid()) {
+        _started.release();
+        return;
+    }
+
+    struct epoll_event events[2];
+    bool readable = _fd != -1;
+    _started.release();
 
     // main loop
-    while (true) {
-        do {
-            len = read(_fd, _buffer, _buffer_size);
-            error = errno;
-            /**
-             * From inotify documentation:
-             *
-             * The behavior when the buffer given to read(2) is too
-             * small to return information about the next event
-             * depends on the kernel version: in kernels  before 2.6.21,
-             * read(2) returns 0; since kernel 2.6.21, read(2) fails with
-             * the error EINVAL.
-             */
-            if (len < 0 && error == EINVAL)
-            {
-                // double the buffer size
-                qWarning() << "buffer size too small";
-                _buffer_size *= 2;
-                _buffer = (char *) realloc(_buffer, _buffer_size);
-                /* and try again ... */
-                continue;
-            }
-        } while (false);
-
-        /* TODO handle len == 0 */
-
-        // reset counter
-        i = 0;
-        // while there are enough events in the buffer
-        while(len >= 0 && (i + sizeof(struct inotify_event)) < len) {
-            // cast an inotify_event
-            event = (struct inotify_event*)&_buffer[i];
-            // with the help of watch descriptor, retrieve, corresponding INotify
-            if (event == NULL) {
-                qDebug() << "NULL event";
+    while (!_stopping.fetchAndAddOrdered(0)) {
+        const int count = epoll_wait(_epollFd, events, 2, nextTimeout());
+        if (count < 0) {
+            if (errno == EINTR)
                 continue;
+            qWarning() << "inotify thread can not wait:" << strerror(errno);
+            break;
+        }
+        for (int e = 0; e < count; ++e) {
+            if (events[e].data.fd == _wakeFd) {
+                quint64 wakeUps;
+                while (read(_wakeFd, &wakeUps, sizeof(wakeUps)) > 0)
+                    ;
+            } else if (readable && !readEvents()) {
+                // the descriptor is gone, the wake ups still work
+                epoll_ctl(_epollFd, EPOLL_CTL_DEL, _fd, 0);
+                readable = false;
             }
-            n = _map[event->wd];
-            // fire event
-            if (event->len > 0) {
-                if (n)
-                    n->fireEvent(event->mask, event->cookie, event->wd, event->name);
-                else
-                    qWarning() << "n is NULL";
-
-                // increment counter
-                i += sizeof(struct inotify_event) + event->len;
+        }
+        fireWakeUps();
+    }
+}
+
+bool
+INotify::INotifyThread::readEvents()
+{
+    int len;
+    int error;
+    // notifiers which got events from the reads below
+    QVarLengthArray<INotify*, 16> pending;
+    bool usable = true;
+
+    // the registrations can not go away until the events
+    // of these reads are queued
+    _readerSequence.fetchAndAddOrdered(1);
+    const Registrations *registrations = _snapshot.fetchAndAddAcquire(0);
+
+    // drain a few buffers at once, but come back to epoll
+    // in time to notice stop() while events keep coming.
+    for (int reads = 0; reads < 16; ++reads) {
+        len = read(_fd, _buffer, _buffer_size);
+        error = errno;
+        if (len < 0 && error == EAGAIN)
+            break;
+        if (len < 0 && error == EINTR)
+            continue;
+        /**
+         * From inotify documentation:
+         *
+         * The behavior when the buffer given to read(2) is too
+         * small to return information about the next event
+         * depends on the kernel version: in kernels  before 2.6.21,
+         * read(2) returns 0; since kernel 2.6.21, read(2) fails with
+         * the error EINVAL.
+         */
+        if ((len == 0 && _buffer_size < sizeof(struct inotify_event) + NAME_MAX + 1)
+                || (len < 0 && error == EINVAL)) {
+            // double the buffer size
+            qWarning() << "buffer size too small";
+            _buffer_size *= 2;
+            _buffer = (char *) realloc(_buffer, _buffer_size);
+            /* and try again ... */
+            continue;
+        }
+        if (len == 0) {
+            // end of file, nothing more will come
+            qDebug() << "inotify descriptor reached its end";
+            usable = false;
+            break;
+        }
+        if (len < 0) {
+            // the descriptor was closed
+            qDebug() << "inotify read failed:" << strerror(error);
+            usable = false;
+            break;
+        }
+        dispatch(len, &registrations, &pending);
+    }
+
+    // one delivery per notifier for everything read
+    for (int p = 0; p < pending.size(); ++p)
+        QMetaObject::invokeMethod(pending[p], "slotDeliverEvents", Qt::QueuedConnection);
+    _readerSequence.fetchAndAddOrdered(1);
+    return usable;
+}
+
+void
+INotify::INotifyThread::dispatch(int len, const Registrations **registrations,
+                                 QVarLengthArray<INotify*, 16> *pending)
+{
+    struct inotify_event* event;
+    INotify* n = NULL;
+    // reset counter
+    int i = 0;
+    // while there are enough events in the buffer
+    while (i + (int) sizeof(struct inotify_event) <= len) {
+        // cast an inotify_event
+        event = (struct inotify_event*)&_buffer[i];
+        // increment counter
+        i += sizeof(struct inotify_event) + event->len;
+
+        if (event->mask & IN_Q_OVERFLOW) {
+            // the kernel dropped events, it does not know for which watch.
+            QMutexLocker lock(&_lock);
+            Registrations::const_iterator it;
+            for (it = _registrations.constBegin(); it != _registrations.constEnd(); ++it) {
+                for (int k = 0; k < it.value().size(); ++k) {
+                    n = it.value().at(k);
+                    n->_overflow.fetchAndStoreRelaxed(1);
+                    if (n->_deliveryPending.testAndSetOrdered(0, 1))
+                        pending->append(n);
+                }
             }
+            continue;
+        }
+
+        // with the help of watch descriptor, retrieve the
+        // INotify objects interested in it
+        QVector<INotify*> notifiers = (*registrations)->value(event->wd);
+        if (notifiers.isEmpty()) {
+            // registered after the snapshot was taken
+            notifiers = lookupMissed(event->wd, registrations);
+        }
+        if (notifiers.isEmpty()) {
+            qWarning() << "no notifier for watch" << event->wd;
+            continue;
+        }
+        for (int k = 0; k < notifiers.size(); ++k) {
+            n = notifiers.at(k);
+            // queue the event, a full queue is reported as overflow
+            n->enqueue(event);
+            if (n->_deliveryPending.testAndSetOrdered(0, 1))
+                pending->append(n);
         }
     }
 }
 
 } // ns mirall
-
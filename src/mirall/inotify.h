@@ -17,14 +17,52 @@
 #ifndef MIRALL_INOTIFY_H
 #define MIRALL_INOTIFY_H
 
+#include <limits.h>
+
+#include <QAtomicInt>
 #include <QObject>
-#include <QMap>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSemaphore>
+#include <QSet>
 #include <QString>
 #include <QThread>
+#include <QTime>
+#include <QVarLengthArray>
+#include <QVector>
+
+#include "mirall/watchtable.h"
+
+struct inotify_event;
 
 namespace Mirall
 {
 
+/**
+ * A decoded inotify event, path is the full path
+ * of the file the event is about.
+ */
+struct INotifyEvent
+{
+    int mask;
+    int cookie;
+    QString path;
+};
+
+typedef QVector<INotifyEvent> INotifyEventList;
+
+/**
+ * Watches directories with inotify and delivers their events
+ *
+ * All instances share one inotify descriptor. The kernel hands
+ * out one watch descriptor per directory, no matter how many
+ * instances watch it, so the watches are kept in a process wide
+ * registry: one table maps descriptors to paths, and every
+ * descriptor knows the instances interested in it. An event is
+ * delivered to all of them, the kernel watch is removed when the
+ * last one lets go.
+ */
 class INotify : public QObject
 {
     Q_OBJECT
@@ -37,41 +75,218 @@ public:
     static void initialize();
     static void cleanup();
 
-    void addPath(const QString &name);
+    /**
+     * Watches the directory, returns false on failure. If given,
+     * limitReached tells whether fs.inotify.max_user_watches
+     * was hit (ENOSPC).
+     */
+    bool addPath(const QString &name, bool *limitReached = 0);
     void removePath(const QString &name);
 
+    /**
+     * Removes the watches of path and of all directories below
+     */
+    void removeTree(const QString &path);
+
+    /**
+     * Updates the watched paths after a directory was moved,
+     * the kernel keeps the watch descriptors across renames.
+     * Returns false if from was not watched.
+     */
+    bool renamePath(const QString &from, const QString &to);
+
     QStringList directories() const;
+    int watchCount() const;
+    bool contains(const QString &path) const;
+
+    /**
+     * Time (msecs since epoch) of the latest event delivered
+     * for a watched directory, 0 if there was none.
+     */
+    qint64 lastEvent(const QString &path) const;
+    qint64 lastEvent(int wd) const;
+
+    /**
+     * Walks the watches of this instance in chunks, starting
+     * with a cursor of 0, see WatchTable::walk().
+     */
+    int walkWatches(int cursor, int count, QList<int> *wds) const;
+
+    /**
+     * Path of a watch of this instance, empty if it is none
+     */
+    QString path(int wd) const;
+
+    /**
+     * Number of events that can wait for delivery. If more
+     * events arrive before they are delivered, the excess is
+     * dropped and an IN_Q_OVERFLOW event is delivered instead.
+     *
+     * Only call this before adding paths.
+     */
+    void setQueueCapacity(int events);
+    int queueCapacity() const;
+
+    /**
+     * Delivery statistics
+     */
+    qint64 eventCount() const;
+    qint64 batchCount() const;
+    int largestBatch() const;
+    // events delivered during the last full second
+    int eventsPerSecond() const;
+
+    /**
+     * Kernel watches held by all instances together
+     */
+    static int kernelWatchCount();
+
+    /**
+     * Emits wakeUp() after msecs. The inotify thread keeps the
+     * time, a later call replaces the pending wake up. Returns
+     * false if the thread is not running, nothing is scheduled
+     * then.
+     */
+    bool wakeUpIn(int msecs);
+    void cancelWakeUp();
+    bool wakeUpPending() const;
+
+    /**
+     * msecs initialize() took until the thread waited for
+     * events, and cleanup() took until the thread was gone.
+     */
+    static int startupTime();
+    static int shutdownTime();
+
 signals:
 
-    void notifyEvent(int mask, int cookie, const QString &name);
+    /**
+     * All events read from the kernel in one go, delivered
+     * in the thread the INotify object lives in.
+     */
+    void notifyEvents(const INotifyEventList &events);
+
+    /**
+     * The time given to wakeUpIn() passed
+     */
+    void wakeUp();
+
+private slots:
+    void slotDeliverEvents();
+    void slotWakeUp();
 
 private:
+    /**
+     * Waits in epoll for the inotify descriptor, for timed
+     * wake ups and for an eventfd the other threads write to
+     * when they want its attention, stop() for example.
+     */
     class INotifyThread : public QThread
     {
-        int _fd;
-        QMap<int, INotify*> _map;
     public:
         INotifyThread(int fd);
         ~INotifyThread();
+        bool isValid() const;
+        // blocks until run() waits for events
+        void waitUntilStarted();
+        // makes run() return as soon as it is done with the
+        // events at hand
+        void stop();
+        // at is msecs since epoch, 0 cancels the wake up
+        void scheduleWakeUp(INotify*, qint64 at);
+        // called from the main thread while the thread reads
         void registerForNotification(INotify*, int);
-        void unregisterForNotification(INotify*);
-        // fireEvent happens from the inotify thread
-        // but addPath comes from the main thread
+        void unregisterForNotification(INotify*, int);
+        // drops all registrations of the notifier, returns once
+        // the thread can no longer reach it
+        void unregisterAll(INotify*);
     protected:
         void run();
     private:
+        typedef QHash<int, QVector<INotify*> > Registrations;
+
+        // the notifiers of a descriptor missing in the snapshot
+        QVector<INotify*> lookupMissed(int wd, const Registrations **snapshot);
+        // reads what the kernel has, returns false once the
+        // descriptor can not be read anymore
+        bool readEvents();
+        void dispatch(int len, const Registrations **registrations,
+                      QVarLengthArray<INotify*, 16> *pending);
+        // epoll_wait() timeout for the next wake up
+        int nextTimeout();
+        void fireWakeUps();
+        void wake();
+
+        int _fd;
+        int _epollFd;
+        int _wakeFd;
+        QAtomicInt _stopping;
+        QSemaphore _started;
+        // the registrations as the main thread changes them,
+        // guarded by _lock
+        QMutex _lock;
+        Registrations _registrations;
+        int _unpublished;
+        // a read only copy of _registrations, the thread reads
+        // it without locking. It is only replaced under _lock.
+        QAtomicPointer<Registrations> _snapshot;
+        // odd while the thread uses the snapshot
+        QAtomicInt _readerSequence;
+        // pending wake ups and the time the thread sleeps
+        // until (-1 for no timeout), guarded by _lock
+        QHash<INotify*, qint64> _wakeUps;
+        qint64 _sleepUntil;
         size_t _buffer_size;
         char *_buffer;
     };
 
+    // a raw event as read from the kernel, the name is
+    // copied so that no allocation happens in the thread.
+    struct RawEvent {
+        int wd;
+        quint32 mask;
+        quint32 cookie;
+        char name[NAME_MAX + 1];
+    };
+
     //INotify(int wd);
-    void fireEvent(int mask, int cookie, int wd, char *name);
+    // called from the inotify thread, returns false if the queue is full
+    bool enqueue(const struct inotify_event *event);
+    // drops the interest in wd, the kernel watch goes with the
+    // last interested instance unless the kernel dropped it
+    void release(int wd, bool dropped);
+
     static int s_fd;
     static INotifyThread* s_thread;
+    static int s_startupTime;
+    static int s_shutdownTime;
+    // the registry shared by all instances
+    static WatchTable s_watches;
+    static QHash<int, QList<INotify*> > s_interest;
 
     // the mask is shared for all paths
     int _mask;
-    QMap<QString, int> _wds;
+    // the watch descriptors this instance is interested in
+    QSet<int> _wds;
+    // msecs since epoch of the pending wake up, 0 for none
+    qint64 _wakeUpAt;
+
+    // single producer (the inotify thread), single consumer
+    // ring buffer of events waiting for delivery.
+    RawEvent  *_queue;
+    int        _queueCapacity;
+    QAtomicInt _queueHead;
+    QAtomicInt _queueTail;
+    QAtomicInt _overflow;
+    QAtomicInt _deliveryPending;
+    INotifyEventList _batch;
+
+    qint64 _eventCount;
+    qint64 _batchCount;
+    int    _largestBatch;
+    int    _eventsPerSecond;
+    int    _rateWindowEvents;
+    QTime  _rateWindow;
 };
 }
 
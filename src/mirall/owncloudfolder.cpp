@@ -25,11 +25,16 @@
 #include "csync.h"
 
 #include "mirall/owncloudfolder.h"
+#include "mirall/owncloudinfo.h"
 #include "mirall/mirallconfigfile.h"
 
-namespace Mirall {
+// an ETag request without an answer after this is aborted
+#define ETAG_TIMEOUT_MSEC 30000
+// a poll sync runs at the latest after this many skipped polls,
+// in case the server does not update the ETag of the root
+#define MAX_SKIPPED_POLLS 20
 
-#define POLL_TIMER_EXCEED 10
+namespace Mirall {
 
 ownCloudFolder::ownCloudFolder(const QString &alias,
                                const QString &path,
@@ -40,40 +45,29 @@ ownCloudFolder::ownCloudFolder(const QString &alias,
     , _localCheckOnly( false )
     , _localFileChanges( false )
     , _csync(0)
-    , _pollTimerCnt(0)
     , _csyncError(false)
     , _lastSeenFiles(0)
+    , _ocInfo(new ownCloudInfo(QString(), this))
+    , _etagReply(0)
+    , _etagTimer(new QTimer(this))
+    , _skippedInRow(0)
 {
-#ifdef USE_INOTIFY
     qDebug() << "****** ownCloud folder using watcher *******";
-    // The folder interval is set in the folder parent class.
-#else
-    /* If local polling is used, the polltimer of class Folder has to fire more
-     * often
-     * Set a local poll time of 2000 milliseconds, which results in a 30 seconds
-     * remote poll interval, defined in slotPollTimerRemoteCheck
-     */
-
-    _pollTimer->stop();
-    connect( _pollTimer, SIGNAL(timeout()), this, SLOT(slotPollTimerRemoteCheck()));
-    setPollInterval( 2000 );
-    _pollTimer->start();
-    qDebug() << "****** ownCloud folder using local poll *******";
-#endif
+    // The folder interval is set in the folder parent class, local
+    // changes are found by the watcher, polling if inotify is blind.
+    connect( _ocInfo, SIGNAL(remoteETag(const QString&, const QString&, QNetworkReply*)),
+             SLOT(slotRemoteETag(const QString&, const QString&, QNetworkReply*)));
+    _etagTimer->setSingleShot( true );
+    _etagTimer->setInterval( ETAG_TIMEOUT_MSEC );
+    connect( _etagTimer, SIGNAL(timeout()), SLOT(slotETagTimeout()));
 }
 
 ownCloudFolder::~ownCloudFolder()
 {
+    // waits for a running sync and closes the csync session
+    delete _csync;
 }
 
-#ifndef USE_INOTIFY
-void ownCloudFolder::slotPollTimerRemoteCheck()
-{
-    _pollTimerCnt++;
-    qDebug() << "**** Poll Timer Cnt increase: " << _pollTimerCnt;
-}
-#endif
-
 bool ownCloudFolder::isBusy() const
 {
     return false;
@@ -105,7 +99,6 @@ void ownCloudFolder::startSync(const QStringList &pathList)
         qCritical() << "* ERROR csync is still running and new sync requested.";
         return;
     }
-    delete _csync;
     _errors.clear();
     _csyncError = false;
 
@@ -119,29 +112,101 @@ void ownCloudFolder::startSync(const QStringList &pathList)
         url.setScheme( "ownclouds" );
     }
 
-#ifdef USE_INOTIFY
-    // if there is a watcher and no polling, ever sync is remote.
+    // there always is a watcher, every sync is remote.
     _localCheckOnly = false;
-#else
-    _localCheckOnly = true;
-    if( _pollTimerCnt == POLL_TIMER_EXCEED || _localFileChanges ) {
-        _localCheckOnly = false;
-        _pollTimerCnt = 0;
-        _localFileChanges = false;
-    }
-#endif
     qDebug() << "*** Start syncing to ownCloud, onlyLocal: " << _localCheckOnly;
+    // csync has no server side move yet, moved items are
+    // uploaded again under their new name.
+    foreach (const PathMove &move, pendingMoves()) {
+        qDebug() << "  * Moved" << move.from << "->" << move.to;
+    }
 
-    _csync = new CSyncThread( path(), url.toEncoded(), _localCheckOnly );
+    // the thread keeps its csync session between runs, it is
+    // only replaced if the server url changed.
+    const QString target = QString::fromLocal8Bit( url.toEncoded() );
+    if( _csync && ( _csync->target() != target || _csync->localCheckOnly() != _localCheckOnly ) ) {
+        qDebug() << "* Sync target changed, new csync session";
+        delete _csync;
+        _csync = 0;
+    }
+    if( !_csync ) {
+        _csync = new CSyncThread( path(), target, _localCheckOnly );
+        QObject::connect(_csync, SIGNAL(started()),  SLOT(slotCSyncStarted()));
+        QObject::connect(_csync, SIGNAL(finished()), SLOT(slotCSyncFinished()));
+        connect(_csync, SIGNAL(csyncError(const QString)), SLOT(slotCSyncError(const QString)));
+
+        connect( _csync, SIGNAL(treeWalkResult(WalkStats)),
+                 this, SLOT(slotThreadTreeWalkResult(WalkStats)));
+    }
     _csync->setUserPwd( cfgFile.ownCloudUser(), cfgFile.ownCloudPasswd() );
-    QObject::connect(_csync, SIGNAL(started()),  SLOT(slotCSyncStarted()));
-    QObject::connect(_csync, SIGNAL(finished()), SLOT(slotCSyncFinished()));
-    QObject::connect(_csync, SIGNAL(terminated()), SLOT(slotCSyncTerminated()));
-    connect(_csync, SIGNAL(csyncError(const QString)), SLOT(slotCSyncError(const QString)));
-
-    connect( _csync, SIGNAL(treeWalkResult(WalkStats*)),
-             this, SLOT(slotThreadTreeWalkResult(WalkStats*)));
-    _csync->start();
+    // the remote state this run syncs, if a poll asked for it
+    _runETag = _pollETag;
+    _pollETag.clear();
+    // the paths the watcher saw changing, empty for a full sync
+    _csync->startSync( pathList );
+}
+
+void ownCloudFolder::pollRemote()
+{
+    if( !syncEnabled() ) {
+        pollSync();
+        return;
+    }
+    if( _etagReply ) {
+        // the answer of the last poll restarts the timer
+        return;
+    }
+    _etagReply = _ocInfo->etagRequest( secondPath() );
+    _etagTimer->start();
+}
+
+void ownCloudFolder::slotETagTimeout()
+{
+    if( !_etagReply )
+        return;
+    qDebug() << "* ETag request of" << alias() << "timed out";
+    // answers with an empty ETag, which asks for a full sync
+    _etagReply->abort();
+}
+
+void ownCloudFolder::slotRemoteETag( const QString& dir, const QString& etag, QNetworkReply *reply )
+{
+    Q_UNUSED( dir );
+    if( !_etagReply || reply != _etagReply ) {
+        return;
+    }
+    _etagReply = 0;
+    _etagTimer->stop();
+
+    if( etag.isEmpty() ) {
+        // the server did not tell, csync has to look
+        qDebug() << "* No ETag for" << alias() << ", full sync";
+        _skippedInRow = 0;
+        pollSync();
+    } else if( etag == _lastETag && _skippedInRow < MAX_SKIPPED_POLLS ) {
+        _skippedInRow++;
+        pollSkipped();
+    } else {
+        if( etag == _lastETag ) {
+            qDebug() << "*" << alias() << "skipped" << _skippedInRow << "polls, full sync";
+        } else {
+            qDebug() << "* ETag of" << alias() << "changed from" << _lastETag << "to" << etag;
+        }
+        _skippedInRow = 0;
+        _pollETag = etag;
+        pollSync();
+    }
+}
+
+bool ownCloudFolder::cancelSync()
+{
+    if( !_csync || !_csync->isRunning() )
+        return false;
+    // a sync which propagates already runs to its end
+    if( !_csync->requestCancel() )
+        return false;
+    qDebug() << "* Cancelling the sync of" << alias();
+    return true;
 }
 
 void ownCloudFolder::slotCSyncStarted()
@@ -150,42 +215,22 @@ void ownCloudFolder::slotCSyncStarted()
     emit syncStarted();
 }
 
-void ownCloudFolder::slotThreadTreeWalkResult( WalkStats *wStats )
+void ownCloudFolder::slotThreadTreeWalkResult( const WalkStats& wStats )
 {
-    qDebug() << "Seen files: " << wStats->seenFiles;
+    qDebug() << "Seen files: " << wStats.seenFiles;
 
     /* check if there are happend changes in the file system */
-    qDebug() << "New     files: " << wStats->newFiles;
-    qDebug() << "Updated files: " << wStats->eval;
-    qDebug() << "Walked  files: " << wStats->seenFiles;
-    qDebug() << "Eval files: "    << wStats->eval;
-    qDebug() << "Removed files: " << wStats->removed;
-    qDebug() << "Renamed files: " << wStats->renamed;
+    qDebug() << "New     files: " << wStats.newFiles;
+    qDebug() << "Updated files: " << wStats.eval;
+    qDebug() << "Walked  files: " << wStats.seenFiles;
+    qDebug() << "Eval files: "    << wStats.eval;
+    qDebug() << "Removed files: " << wStats.removed;
+    qDebug() << "Renamed files: " << wStats.renamed;
 
     if( ! _localCheckOnly ) _lastSeenFiles = 0;
     _localFileChanges = false;
 
-#ifndef USE_INOTIFY
-    if( _lastSeenFiles > 0 && _lastSeenFiles != wStats->seenFiles ) {
-        qDebug() << "*** last seen files different from currently seen number " << _lastSeenFiles << "<>" << wStats->seenFiles << " => full Sync needed";
-        _localFileChanges = true;
-    }
-    if( (wStats->newFiles + wStats->eval + wStats->removed + wStats->renamed) > 0 ) {
-         qDebug() << "*** Local changes, lets do a full sync!" ;
-         _localFileChanges = true;
-    }
-    if( _pollTimerCnt < POLL_TIMER_EXCEED ) {
-        qDebug() << "     *** No local changes, finalize, pollTimerCounter is "<< _pollTimerCnt ;
-    }
-#endif
-    _lastSeenFiles = wStats->seenFiles;
-
-    /*
-     * Attention: This is deleted here, outside of the thread, because the thread can
-     * faster die than this routine has read out the memory.
-     */
-    delete wStats->sourcePath;
-    delete wStats;
+    _lastSeenFiles = wStats.seenFiles;
 }
 
 void ownCloudFolder::slotCSyncError(const QString& err)
@@ -194,21 +239,15 @@ void ownCloudFolder::slotCSyncError(const QString& err)
     _csyncError = true;
 }
 
-void ownCloudFolder::slotCSyncTerminated()
-{
-    // do not ask csync here for reasons.
-    SyncResult res( SyncResult::Error );
-    _errors.append( tr("The CSync thread terminated unexpectedly.") );
-    res.setErrorStrings(_errors);
-
-    emit syncFinished( res );
-}
-
 void ownCloudFolder::slotCSyncFinished()
 {
     SyncResult res( SyncResult::Success );
 
-    if (_csyncError) {
+    if (_csync->wasCancelled()) {
+        // nothing was changed, the sync runs again later
+        res.setStatus(SyncResult::NotYetStarted);
+        qDebug() << "    * owncloud csync thread was cancelled";
+    } else if (_csyncError) {
         res.setStatus(SyncResult::Error);
 
         qDebug() << "  ** error Strings: " << _errors;
@@ -220,6 +259,19 @@ void ownCloudFolder::slotCSyncFinished()
 
     if( ! _localCheckOnly ) _lastSeenFiles = 0;
 
+    // the remote changes up to the ETag are synced now. What the
+    // sync uploaded changes it again, the next poll syncs once more.
+    if( res.status() == SyncResult::Success && !_runETag.isEmpty() ) {
+        _lastETag = _runETag;
+    } else if( res.status() == SyncResult::NotYetStarted && !_runETag.isEmpty() && _pollETag.isEmpty() ) {
+        // the cancelled run is scheduled again
+        _pollETag = _runETag;
+    }
+    _runETag.clear();
+
+    res.setProfile( _csync->profile() );
+    qDebug() << "    * sync of" << alias() << "waited" << _csync->queueTime()
+             << "msec for a worker and ran" << _csync->runTime() << "msec";
     emit syncFinished( res );
 }
 
@@ -24,9 +24,13 @@
 #include "mirall/csyncthread.h"
 
 class QProcess;
+class QNetworkReply;
+class QTimer;
 
 namespace Mirall {
 
+class ownCloudInfo;
+
 class ownCloudFolder : public Folder
 {
     Q_OBJECT
@@ -38,6 +42,14 @@ public:
     QString secondPath() const;
     virtual bool isBusy() const;
     virtual void startSync(const QStringList &pathList);
+    virtual bool cancelSync();
+
+protected:
+    /**
+     * Asks the server for the ETag of the folder and only syncs
+     * if it differs from the one of the last poll sync.
+     */
+    virtual void pollRemote();
 
 public slots:
     void startSync();
@@ -46,21 +58,29 @@ private slots:
     void slotCSyncStarted();
     void slotCSyncError(const QString& );
     void slotCSyncFinished();
-    void slotThreadTreeWalkResult( WalkStats* );
-    void slotCSyncTerminated();
+    void slotThreadTreeWalkResult( const WalkStats& );
+    void slotRemoteETag( const QString&, const QString&, QNetworkReply* );
+    void slotETagTimeout();
 
-#ifndef USE_INOTIFY
-    void slotPollTimerRemoteCheck();
-#endif
 private:
     QString      _secondPath;
     CSyncThread *_csync;
     bool         _localCheckOnly;
     bool         _localFileChanges;
-    int          _pollTimerCnt;
     QStringList  _errors;
     bool         _csyncError;
     ulong        _lastSeenFiles;
+    ownCloudInfo *_ocInfo;
+    // the ETag request of the current poll, 0 if there is none
+    QNetworkReply *_etagReply;
+    QTimer       *_etagTimer;
+    // polls skipped since the last poll sync
+    int          _skippedInRow;
+    // the ETag the last successful poll sync started with, the
+    // one a poll found and the one of the running sync
+    QString      _lastETag;
+    QString      _pollETag;
+    QString      _runETag;
 };
 
 }
@@ -28,6 +28,7 @@ namespace Mirall
 {
 
 QNetworkAccessManager* ownCloudInfo::_manager = 0;
+int             ownCloudInfo::_instances = 0;
 SslErrorDialog *ownCloudInfo::_sslErrorDialog = 0;
 bool            ownCloudInfo::_certsUntrusted = false;
 
@@ -44,6 +45,7 @@ ownCloudInfo::ownCloudInfo( const QString& connectionName, QObject *parent ) :
         qDebug() << "Creating static NetworkAccessManager";
         _manager = new QNetworkAccessManager;
     }
+    _instances++;
 
     connect( _manager, SIGNAL( sslErrors(QNetworkReply*, QList<QSslError>)),
              this, SLOT(slotSSLFailed(QNetworkReply*, QList<QSslError>)) );
@@ -54,8 +56,13 @@ ownCloudInfo::ownCloudInfo( const QString& connectionName, QObject *parent ) :
 
 ownCloudInfo::~ownCloudInfo()
 {
+    // other instances still use them
+    if( --_instances > 0 )
+        return;
     delete _manager;
+    _manager = 0;
     delete _sslErrorDialog;
+    _sslErrorDialog = 0;
 }
 
 bool ownCloudInfo::isConfigured()
@@ -107,6 +114,60 @@ void ownCloudInfo::mkdirRequest( const QString& dir )
              this, SLOT(slotError(QNetworkReply::NetworkError )));
 }
 
+QNetworkReply* ownCloudInfo::etagRequest( const QString& dir )
+{
+    qDebug() << "OCInfo ETag of " << dir;
+
+    MirallConfigFile cfgFile;
+    QNetworkRequest req;
+    req.setUrl( QUrl( cfgFile.ownCloudUrl( _connection, true ) + dir ) );
+    // the collection only, not its children
+    req.setRawHeader( QByteArray("Depth"), QByteArray("0") );
+    QByteArray xml( "<?xml version=\"1.0\" ?>\n"
+                    "<d:propfind xmlns:d=\"DAV:\">\n"
+                    "  <d:prop><d:getetag/></d:prop>\n"
+                    "</d:propfind>\n" );
+    QNetworkReply *reply = davRequest("PROPFIND", req, &xml);
+    _directories[reply] = dir;
+
+    connect( reply, SIGNAL(finished()), SLOT(slotETagFinished()) );
+    connect( reply, SIGNAL( error(QNetworkReply::NetworkError )),
+             this, SLOT(slotError(QNetworkReply::NetworkError )));
+    return reply;
+}
+
+void ownCloudInfo::slotETagFinished()
+{
+    QNetworkReply *reply = qobject_cast<QNetworkReply *>(sender());
+
+    if( ! reply ) {
+        qDebug() << "ownCloudInfo: Reply empty!";
+        return;
+    }
+
+    const QString dir = _directories.take( reply );
+    QString etag;
+    if( reply->error() == QNetworkReply::NoError ) {
+        // the multistatus has a single response for the collection
+        QXmlStreamReader reader( reply );
+        while( !reader.atEnd() ) {
+            if( reader.readNext() != QXmlStreamReader::StartElement
+                || reader.namespaceUri() != QLatin1String("DAV:") )
+                continue;
+            if( reader.name() == QLatin1String("getetag") ) {
+                etag = reader.readElementText();
+            }
+        }
+        if( reader.hasError() ) {
+            qDebug() << "OCInfo ETag answer of" << dir << "unreadable:" << reader.errorString();
+            etag.clear();
+        }
+    }
+
+    emit remoteETag( dir, etag, reply );
+    reply->deleteLater();
+}
+
 void ownCloudInfo::slotMkdirFinished()
 {
     QNetworkReply *reply = qobject_cast<QNetworkReply *>(sender());
@@ -122,8 +183,11 @@ void ownCloudInfo::slotMkdirFinished()
 }
 
 
-void ownCloudInfo::slotAuthentication( QNetworkReply*, QAuthenticator *auth )
+void ownCloudInfo::slotAuthentication( QNetworkReply *reply, QAuthenticator *auth )
 {
+    // the manager is shared, each instance answers for its own requests
+    if( reply && reply->request().originatingObject() != this )
+        return;
     if( auth ) {
         MirallConfigFile cfgFile;
         qDebug() << "Authenticating request!";
@@ -134,6 +198,8 @@ void ownCloudInfo::slotAuthentication( QNetworkReply*, QAuthenticator *auth )
 
 void ownCloudInfo::slotSSLFailed( QNetworkReply *reply, QList<QSslError> errors )
 {
+    if( reply->request().originatingObject() != this )
+        return;
     qDebug() << "SSL-Warnings happened for url " << reply->url().toString();
 
     if( _certsUntrusted ) {
@@ -243,6 +309,7 @@ void ownCloudInfo::setupHeaders( QNetworkRequest & req, quint64 size )
 
     QUrl url( cfgFile.ownCloudUrl( QString(), false ) );
     qDebug() << "Setting up host header: " << url.host();
+    req.setOriginatingObject( this );
     req.setRawHeader( QByteArray("Host"), url.host().toUtf8() );
     req.setRawHeader( QByteArray("User-Agent"), QString("mirall-%1").arg(MIRALL_STRINGIFY(MIRALL_VERSION)).toAscii());
     req.setRawHeader( QByteArray("Authorization"), cfgFile.basicAuthHeader() );
@@ -259,8 +326,14 @@ QNetworkReply* ownCloudInfo::davRequest(const QString& reqVerb,  QNetworkRequest
 
     setupHeaders(req, quint64(data ? data->size() : 0));
     if( data ) {
-        QBuffer iobuf( data );
-        return _manager->sendCustomRequest(req, reqVerb.toUtf8(), &iobuf );
+        // the body is read while the request is sent, it has to
+        // live as long as the reply
+        QBuffer *iobuf = new QBuffer;
+        iobuf->setData( *data );
+        iobuf->open( QIODevice::ReadOnly );
+        QNetworkReply *reply = _manager->sendCustomRequest(req, reqVerb.toUtf8(), iobuf );
+        iobuf->setParent( reply );
+        return reply;
     } else {
         return _manager->sendCustomRequest(req, reqVerb.toUtf8(), 0 );
     }
@@ -59,6 +59,13 @@ public:
       */
     void mkdirRequest( const QString& );
 
+    /**
+      * Asks for the ETag of a collection, without its children.
+      * Provide a relative path. The answer comes with remoteETag(),
+      * aborting the returned reply answers with an empty ETag.
+      */
+    QNetworkReply* etagRequest( const QString& );
+
 signals:
     // result signal with url- and version string.
     void ownCloudInfoFound( const QString&,  const QString& );
@@ -66,6 +73,8 @@ signals:
     void ownCloudDirExists( const QString&, QNetworkReply* );
 
     void webdavColCreated( QNetworkReply* );
+    // the ETag, empty on errors or if the server has none
+    void remoteETag( const QString&, const QString&, QNetworkReply* );
 
 public slots:
 
@@ -76,12 +85,15 @@ protected slots:
     void slotSSLFailed( QNetworkReply *reply, QList<QSslError> errors );
 
     void slotMkdirFinished();
+    void slotETagFinished();
 
 private:
     void setupHeaders(QNetworkRequest &req, quint64 size );
     QNetworkReply* davRequest(const QString&, QNetworkRequest&, QByteArray* );
 
     static QNetworkAccessManager  *_manager;
+    // the manager is shared, the last instance deletes it
+    static int                     _instances;
     QString                        _connection;
     QHash<QNetworkReply*, QString> _directories;
     static SslErrorDialog         *_sslErrorDialog;
@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) by Duncan Mac-Vicar P. <duncan@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+
+#include <QDebug>
+
+#include "mirall/pendingtree.h"
+
+// changed children of a directory before it is collapsed
+#define DEFAULT_MAX_FAN_OUT 1000
+// roughly 10 MB with typical file names
+#define DEFAULT_MAX_NODES 100000
+
+namespace Mirall
+{
+
+PendingTree::PendingTree(const QString &root)
+    : _root(root),
+      _top(new Node),
+      _maxFanOut(DEFAULT_MAX_FAN_OUT),
+      _maxNodes(DEFAULT_MAX_NODES),
+      _nodes(1),
+      _collapsed(0)
+{
+    _top->parent = 0;
+    _top->change = NoChange;
+    _top->collapsed = false;
+}
+
+PendingTree::~PendingTree()
+{
+    deleteChildren(_top);
+    delete _top;
+}
+
+QString PendingTree::root() const
+{
+    return _root;
+}
+
+int PendingTree::maxFanOut() const
+{
+    return _maxFanOut;
+}
+
+void PendingTree::setMaxFanOut(int children)
+{
+    _maxFanOut = qMax(children, 1);
+}
+
+int PendingTree::maxNodes() const
+{
+    return _maxNodes;
+}
+
+void PendingTree::setMaxNodes(int nodes)
+{
+    _maxNodes = qMax(nodes, 1);
+}
+
+void PendingTree::note(const QString &path, Change change)
+{
+    QStringList components;
+    if (!split(path, &components)) {
+        qDebug() << "* Pending change outside of" << _root << ":" << path;
+        return;
+    }
+
+    Node *node = _top;
+    bool added = false;
+    for (int i = 0; i < components.size(); ++i) {
+        const QString &name = components.at(i);
+        if (node->collapsed)
+            return;
+        Node *child = node->children.value(name);
+        if (!child) {
+            child = new Node;
+            child->name = name;
+            child->parent = node;
+            child->change = NoChange;
+            child->collapsed = false;
+            node->children.insert(name, child);
+            _nodes++;
+            added = true;
+            if (node->children.size() > _maxFanOut) {
+                qDebug() << "* Collapsing pending changes below"
+                         << QStringList(components.mid(0, i)).join(QLatin1String("/"))
+                         << "of" << _root;
+                collapse(node);
+                return;
+            }
+        }
+        node = child;
+    }
+    if (node->collapsed)
+        return;
+
+    switch (node->change) {
+    case NoChange:
+        node->change = change;
+        break;
+    case Created:
+        // created and gone again, nothing to sync. Otherwise
+        // it stays a new file.
+        if (change == Deleted) {
+            node->change = NoChange;
+            prune(node);
+        }
+        return;
+    case Deleted:
+        // deleted and created again, it was replaced
+        if (change != Deleted)
+            node->change = Modified;
+        return;
+    default:
+        if (change == Deleted)
+            node->change = Deleted;
+        return;
+    }
+
+    // the subtree which just grew is the one to give up first
+    Node *parent = node->parent ? node->parent : node;
+    while (added && _nodes > _maxNodes && parent) {
+        collapse(parent);
+        parent = parent->parent;
+    }
+}
+
+PendingTree::Change PendingTree::change(const QString &path) const
+{
+    const Node *node = find(path);
+    return node ? Change(node->change) : NoChange;
+}
+
+bool PendingTree::isCovered(const QString &path) const
+{
+    QStringList components;
+    if (!split(path, &components))
+        return false;
+
+    const Node *node = _top;
+    foreach (const QString &name, components) {
+        if (node->collapsed)
+            return true;
+        node = node->children.value(name);
+        if (!node)
+            return false;
+    }
+    return node->collapsed;
+}
+
+QStringList PendingTree::paths() const
+{
+    QStringList list;
+    collect(_top, _root, &list);
+    return list;
+}
+
+bool PendingTree::isEmpty() const
+{
+    return _top->children.isEmpty() && _top->change == NoChange && !_top->collapsed;
+}
+
+int PendingTree::nodeCount() const
+{
+    return _nodes;
+}
+
+int PendingTree::collapsedCount() const
+{
+    return _collapsed;
+}
+
+void PendingTree::clear()
+{
+    deleteChildren(_top);
+    _top->change = NoChange;
+    _top->collapsed = false;
+    _collapsed = 0;
+}
+
+PendingTree::Node *PendingTree::find(const QString &path) const
+{
+    QStringList components;
+    if (!split(path, &components))
+        return 0;
+
+    Node *node = _top;
+    foreach (const QString &name, components) {
+        node = node->children.value(name);
+        if (!node)
+            return 0;
+    }
+    return node;
+}
+
+bool PendingTree::split(const QString &path, QStringList *components) const
+{
+    if (path == _root)
+        return true;
+    const QString prefix = _root.endsWith(QLatin1Char('/')) ? _root : _root + QLatin1Char('/');
+    if (!path.startsWith(prefix))
+        return false;
+    *components = path.mid(prefix.length()).split(QLatin1Char('/'), QString::SkipEmptyParts);
+    return true;
+}
+
+void PendingTree::collapse(Node *node)
+{
+    deleteChildren(node);
+    if (!node->collapsed) {
+        node->collapsed = true;
+        _collapsed++;
+    }
+}
+
+void PendingTree::deleteChildren(Node *node)
+{
+    foreach (Node *child, node->children) {
+        deleteChildren(child);
+        if (child->collapsed)
+            _collapsed--;
+        delete child;
+        _nodes--;
+    }
+    node->children.clear();
+}
+
+void PendingTree::prune(Node *node)
+{
+    while (node != _top && node->change == NoChange && !node->collapsed
+           && node->children.isEmpty()) {
+        Node *parent = node->parent;
+        parent->children.remove(node->name);
+        delete node;
+        _nodes--;
+        node = parent;
+    }
+}
+
+void PendingTree::collect(const Node *node, const QString &path, QStringList *paths) const
+{
+    if (node->change != NoChange || node->collapsed)
+        paths->append(path);
+    QHash<QString, Node*>::const_iterator it;
+    for (it = node->children.constBegin(); it != node->children.constEnd(); ++it)
+        collect(it.value(), path + QLatin1Char('/') + it.key(), paths);
+}
+
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) by Duncan Mac-Vicar P. <duncan@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+
+#ifndef MIRALL_PENDINGTREE_H
+#define MIRALL_PENDINGTREE_H
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+
+namespace Mirall
+{
+
+/**
+ * The changed paths below a folder, kept as a tree
+ *
+ * Every path component is stored once. A directory with more
+ * changed children than maxFanOut() is collapsed into a single
+ * dirty marker, everything below it needs a look anyway. Once
+ * more than maxNodes() nodes are held, the subtree which got the
+ * latest change is collapsed until the tree fits again, so the
+ * memory stays bounded when a whole tree changes at once.
+ */
+class PendingTree
+{
+public:
+    // what happened to a path since the tree was cleared,
+    // after merging all its changes
+    enum Change {
+        NoChange = 0,
+        Created,
+        Modified,
+        Deleted
+    };
+
+    explicit PendingTree(const QString &root);
+    ~PendingTree();
+
+    QString root() const;
+
+    /**
+     * Changed children a directory keeps before it collapses
+     */
+    int maxFanOut() const;
+    void setMaxFanOut(int children);
+
+    /**
+     * Nodes the tree holds at most, a node takes around a
+     * hundred bytes plus its name.
+     */
+    int maxNodes() const;
+    void setMaxNodes(int nodes);
+
+    /**
+     * Merges change into the state of path. A path created and
+     * deleted again is dropped, one deleted and created again
+     * is modified. Paths below a collapsed directory are
+     * covered by it and not stored.
+     */
+    void note(const QString &path, Change change);
+
+    /**
+     * The merged change of path, NoChange if the path is not
+     * pending itself. Collapsing drops the changes below.
+     */
+    Change change(const QString &path) const;
+
+    /**
+     * True if a collapsed directory covers path
+     */
+    bool isCovered(const QString &path) const;
+
+    /**
+     * The pending paths and the roots of collapsed subtrees,
+     * parents before their children.
+     */
+    QStringList paths() const;
+
+    bool isEmpty() const;
+    int nodeCount() const;
+    int collapsedCount() const;
+    void clear();
+
+private:
+    struct Node {
+        QString name;
+        Node *parent;
+        QHash<QString, Node*> children;
+        int change;
+        // the whole subtree changed
+        bool collapsed;
+    };
+
+    Node *find(const QString &path) const;
+    // the path components relative to the root, false if
+    // path is not below the root
+    bool split(const QString &path, QStringList *components) const;
+    void collapse(Node *node);
+    void deleteChildren(Node *node);
+    // removes node and its parents as long as they hold nothing
+    void prune(Node *node);
+    void collect(const Node *node, const QString &path, QStringList *paths) const;
+
+    QString _root;
+    Node *_top;
+    int _maxFanOut;
+    int _maxNodes;
+    int _nodes;
+    int _collapsed;
+};
+
+}
+
+#endif
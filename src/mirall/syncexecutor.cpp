@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) by Duncan Mac-Vicar P. <duncan@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+
+#include <QDateTime>
+#include <QDebug>
+#include <QMutexLocker>
+#include <QThread>
+
+#include "mirall/syncexecutor.h"
+
+namespace Mirall {
+
+class SyncWorker : public QThread
+{
+public:
+    SyncWorker(SyncExecutor *executor)
+        : _executor(executor) {}
+
+protected:
+    void run()
+    {
+        while (SyncJob *job = _executor->takeJob()) {
+            job->execute();
+            _executor->finishJob(job);
+        }
+    }
+
+private:
+    SyncExecutor *_executor;
+};
+
+SyncJob::SyncJob()
+    : _queuedAt(-1),
+      _startedAt(-1),
+      _finishedAt(-1)
+{
+}
+
+SyncJob::~SyncJob()
+{
+}
+
+void SyncJob::done()
+{
+}
+
+int SyncJob::queueTime() const
+{
+    if (_startedAt < 0)
+        return -1;
+    return int(_startedAt - _queuedAt);
+}
+
+int SyncJob::runTime() const
+{
+    if (_finishedAt < _startedAt)
+        return -1;
+    return int(_finishedAt - _startedAt);
+}
+
+SyncExecutor *SyncExecutor::s_instance = 0;
+
+SyncExecutor::SyncExecutor(int workers)
+    : _workerCount(qMax(workers, 1)),
+      _stopping(false)
+{
+}
+
+SyncExecutor::~SyncExecutor()
+{
+    _mutex.lock();
+    _stopping = true;
+    if (!_queue.isEmpty())
+        qDebug() << "* Sync executor drops" << _queue.size() << "queued jobs";
+    _queue.clear();
+    _jobQueued.wakeAll();
+    _mutex.unlock();
+
+    // running jobs finish first
+    foreach (SyncWorker *worker, _workers) {
+        worker->wait();
+        delete worker;
+    }
+}
+
+SyncExecutor *SyncExecutor::instance()
+{
+    if (!s_instance)
+        initialize(1);
+    return s_instance;
+}
+
+void SyncExecutor::initialize(int workers)
+{
+    if (s_instance) {
+        s_instance->setWorkerCount(workers);
+        return;
+    }
+    s_instance = new SyncExecutor(workers);
+}
+
+void SyncExecutor::cleanup()
+{
+    delete s_instance;
+    s_instance = 0;
+}
+
+void SyncExecutor::setWorkerCount(int workers)
+{
+    QMutexLocker lock(&_mutex);
+    _workerCount = qMax(workers, 1);
+    // more jobs can run now, the workers are started on demand
+    while (_workers.size() < qMin(_workerCount, _queue.size() + _running.size())) {
+        SyncWorker *worker = new SyncWorker(this);
+        _workers.append(worker);
+        worker->start();
+    }
+    _jobQueued.wakeAll();
+}
+
+int SyncExecutor::workerCount() const
+{
+    QMutexLocker lock(&_mutex);
+    return _workerCount;
+}
+
+bool SyncExecutor::enqueue(SyncJob *job)
+{
+    QMutexLocker lock(&_mutex);
+    if (_stopping || _queue.contains(job) || _running.contains(job))
+        return false;
+
+    job->_queuedAt = QDateTime::currentMSecsSinceEpoch();
+    job->_startedAt = -1;
+    job->_finishedAt = -1;
+    _queue.enqueue(job);
+
+    // a thread per job that can run at the same time, idle
+    // ones wait for the next job.
+    if (_workers.size() < qMin(_workerCount, _queue.size() + _running.size())) {
+        SyncWorker *worker = new SyncWorker(this);
+        _workers.append(worker);
+        worker->start();
+    }
+    _jobQueued.wakeOne();
+    return true;
+}
+
+bool SyncExecutor::remove(SyncJob *job)
+{
+    QMutexLocker lock(&_mutex);
+    if (!_queue.removeOne(job))
+        return false;
+    _jobFinished.wakeAll();
+    return true;
+}
+
+bool SyncExecutor::isBusy(SyncJob *job) const
+{
+    QMutexLocker lock(&_mutex);
+    return _queue.contains(job) || _running.contains(job);
+}
+
+void SyncExecutor::wait(SyncJob *job)
+{
+    QMutexLocker lock(&_mutex);
+    while (_queue.contains(job) || _running.contains(job) || _finishing.contains(job))
+        _jobFinished.wait(&_mutex);
+}
+
+int SyncExecutor::queuedJobs() const
+{
+    QMutexLocker lock(&_mutex);
+    return _queue.size();
+}
+
+int SyncExecutor::runningJobs() const
+{
+    QMutexLocker lock(&_mutex);
+    return _running.size();
+}
+
+int SyncExecutor::threadCount() const
+{
+    QMutexLocker lock(&_mutex);
+    return _workers.size();
+}
+
+SyncJob *SyncExecutor::takeJob()
+{
+    QMutexLocker lock(&_mutex);
+    while (!_stopping && (_queue.isEmpty() || _running.size() >= _workerCount))
+        _jobQueued.wait(&_mutex);
+    if (_stopping)
+        return 0;
+
+    SyncJob *job = _queue.dequeue();
+    job->_startedAt = QDateTime::currentMSecsSinceEpoch();
+    _running.append(job);
+    return job;
+}
+
+void SyncExecutor::finishJob(SyncJob *job)
+{
+    _mutex.lock();
+    job->_finishedAt = QDateTime::currentMSecsSinceEpoch();
+    _running.removeOne(job);
+    _finishing[job]++;
+    // a job held back by the worker count can start now
+    _jobQueued.wakeOne();
+    _mutex.unlock();
+
+    job->done();
+
+    _mutex.lock();
+    if (--_finishing[job] == 0)
+        _finishing.remove(job);
+    _jobFinished.wakeAll();
+    _mutex.unlock();
+}
+
+}
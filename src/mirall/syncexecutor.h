@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) by Duncan Mac-Vicar P. <duncan@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+
+#ifndef MIRALL_SYNCEXECUTOR_H
+#define MIRALL_SYNCEXECUTOR_H
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QQueue>
+#include <QWaitCondition>
+
+namespace Mirall {
+
+class SyncWorker;
+
+/**
+ * A unit of work for the SyncExecutor
+ *
+ * execute() runs on one of the worker threads. A job can be
+ * handed to the executor again once it finished, it is not
+ * deleted by it.
+ */
+class SyncJob
+{
+public:
+    SyncJob();
+    virtual ~SyncJob();
+
+    /**
+     * Does the work, called on a worker thread
+     */
+    virtual void execute() = 0;
+
+    /**
+     * Called on the worker thread after execute() returned and
+     * the job is no longer busy, it can be queued again from
+     * here on.
+     */
+    virtual void done();
+
+    /**
+     * msecs the last run waited in the queue and took to
+     * execute, -1 before the first run.
+     */
+    int queueTime() const;
+    int runTime() const;
+
+private:
+    friend class SyncExecutor;
+    qint64 _queuedAt;
+    qint64 _startedAt;
+    qint64 _finishedAt;
+};
+
+/**
+ * Runs sync jobs on a fixed set of long lived threads
+ *
+ * Jobs are run in the order they were queued, at most
+ * workerCount() at the same time. The threads are started when
+ * they are first needed and stay until cleanup().
+ */
+class SyncExecutor
+{
+public:
+    explicit SyncExecutor(int workers);
+    ~SyncExecutor();
+
+    /**
+     * The executor the folders run their syncs on. It is made
+     * with one worker if initialize() was not called.
+     */
+    static SyncExecutor *instance();
+    static void initialize(int workers);
+    static void cleanup();
+
+    /**
+     * Lowering the count does not interrupt running jobs, it
+     * only keeps further ones from starting.
+     */
+    void setWorkerCount(int workers);
+    int workerCount() const;
+
+    /**
+     * Queues the job, false if it is queued or running already
+     */
+    bool enqueue(SyncJob *job);
+
+    /**
+     * Takes the job out of the queue if it did not start yet
+     */
+    bool remove(SyncJob *job);
+
+    /**
+     * True from enqueue() until execute() returned
+     */
+    bool isBusy(SyncJob *job) const;
+
+    /**
+     * Blocks until the job is neither queued nor running and
+     * its done() returned.
+     */
+    void wait(SyncJob *job);
+
+    int queuedJobs() const;
+    int runningJobs() const;
+    // threads started so far
+    int threadCount() const;
+
+private:
+    friend class SyncWorker;
+
+    // blocks until there is a job for a worker, 0 on shutdown
+    SyncJob *takeJob();
+    void finishJob(SyncJob *job);
+
+    static SyncExecutor *s_instance;
+
+    mutable QMutex _mutex;
+    QWaitCondition _jobQueued;
+    QWaitCondition _jobFinished;
+    QQueue<SyncJob*> _queue;
+    QList<SyncJob*> _running;
+    // jobs whose done() is still being called
+    QHash<SyncJob*, int> _finishing;
+    QList<SyncWorker*> _workers;
+    int _workerCount;
+    bool _stopping;
+};
+
+}
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) by Duncan Mac-Vicar P. <duncan@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+
+#include <QStringList>
+#include <QtAlgorithms>
+
+#include "mirall/syncprofile.h"
+
+namespace Mirall
+{
+
+SyncProfile::SyncProfile()
+    : _times( PhaseCount, -1 ),
+      _files( PhaseCount, 0 ),
+      _errors( PhaseCount, 0 )
+{
+}
+
+QString SyncProfile::phaseName( Phase phase )
+{
+    switch( phase ) {
+    case CreatePhase:
+        return QLatin1String("create");
+    case InitPhase:
+        return QLatin1String("init");
+    case UpdatePhase:
+        return QLatin1String("update");
+    case WalkPhase:
+        return QLatin1String("walk");
+    case ReconcilePhase:
+        return QLatin1String("reconcile");
+    case PropagatePhase:
+        return QLatin1String("propagate");
+    default:
+        break;
+    }
+    return QString();
+}
+
+void SyncProfile::setTime( Phase phase, int msecs )
+{
+    _times[phase] = msecs;
+}
+
+int SyncProfile::time( Phase phase ) const
+{
+    return _times.at(phase);
+}
+
+void SyncProfile::setFiles( Phase phase, ulong files )
+{
+    _files[phase] = files;
+}
+
+ulong SyncProfile::files( Phase phase ) const
+{
+    return _files.at(phase);
+}
+
+void SyncProfile::addError( Phase phase )
+{
+    _errors[phase]++;
+}
+
+int SyncProfile::errors( Phase phase ) const
+{
+    return _errors.at(phase);
+}
+
+int SyncProfile::errorCount() const
+{
+    int count = 0;
+    foreach( int errors, _errors )
+        count += errors;
+    return count;
+}
+
+int SyncProfile::totalTime() const
+{
+    int total = 0;
+    foreach( int msecs, _times ) {
+        if( msecs > 0 )
+            total += msecs;
+    }
+    return total;
+}
+
+bool SyncProfile::isEmpty() const
+{
+    foreach( int msecs, _times ) {
+        if( msecs >= 0 )
+            return false;
+    }
+    return true;
+}
+
+QString SyncProfile::toString() const
+{
+    QStringList phases;
+    for( int i = 0; i < PhaseCount; ++i ) {
+        if( _times.at(i) < 0 )
+            continue;
+        QString phase = QString::fromLatin1("%1 %2ms").arg( phaseName( Phase(i) ) ).arg( _times.at(i) );
+        if( _files.at(i) )
+            phase += QString::fromLatin1(" %1 files").arg( _files.at(i) );
+        if( _errors.at(i) )
+            phase += QString::fromLatin1(" %1 errors").arg( _errors.at(i) );
+        phases.append( phase );
+    }
+    return phases.join( QLatin1String(", ") );
+}
+
+int SyncProfile::medianTime( const QList<SyncProfile> &profiles, Phase phase )
+{
+    QList<int> times;
+    foreach( const SyncProfile &profile, profiles ) {
+        if( profile.time( phase ) >= 0 )
+            times.append( profile.time( phase ) );
+    }
+    if( times.isEmpty() )
+        return -1;
+    qSort( times );
+    return times.at( times.size() / 2 );
+}
+
+}
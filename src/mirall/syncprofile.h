@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) by Duncan Mac-Vicar P. <duncan@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+
+#ifndef MIRALL_SYNCPROFILE_H
+#define MIRALL_SYNCPROFILE_H
+
+#include <QList>
+#include <QString>
+#include <QVector>
+
+namespace Mirall
+{
+
+/**
+ * Timings and counters of the phases of one sync run
+ *
+ * A phase which did not run has a time of -1, the phases
+ * creating the session do not run if it was kept from the run
+ * before.
+ */
+class SyncProfile
+{
+public:
+    enum Phase {
+        CreatePhase,
+        InitPhase,
+        UpdatePhase,
+        WalkPhase,
+        ReconcilePhase,
+        PropagatePhase,
+        PhaseCount
+    };
+
+    SyncProfile();
+
+    static QString phaseName( Phase phase );
+
+    /**
+     * msecs the phase took, -1 if it did not run
+     */
+    void setTime( Phase phase, int msecs );
+    int time( Phase phase ) const;
+
+    /**
+     * Files the phase went through, as far as csync tells
+     */
+    void setFiles( Phase phase, ulong files );
+    ulong files( Phase phase ) const;
+
+    void addError( Phase phase );
+    int errors( Phase phase ) const;
+    int errorCount() const;
+
+    /**
+     * Sum of the phase times
+     */
+    int totalTime() const;
+
+    /**
+     * True if no phase ran
+     */
+    bool isEmpty() const;
+
+    QString toString() const;
+
+    /**
+     * The median time of the phase over the profiles it ran in,
+     * -1 if it ran in none of them.
+     */
+    static int medianTime( const QList<SyncProfile> &profiles, Phase phase );
+
+private:
+    QVector<int> _times;
+    QVector<ulong> _files;
+    QVector<int> _errors;
+};
+
+}
+
+#endif
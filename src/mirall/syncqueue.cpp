@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) by Duncan Mac-Vicar P. <duncan@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+
+#include <QtAlgorithms>
+
+#include "mirall/syncqueue.h"
+
+// a waiting folder moves up one trigger after this long
+#define DEFAULT_AGING_STEP_MSEC (5*60*1000)
+// wait times kept per trigger for the percentiles
+#define WAIT_HISTORY 200
+
+namespace Mirall
+{
+
+namespace {
+
+struct Candidate {
+    int rank;
+    int cost;
+    qint64 queuedAt;
+    QString alias;
+
+    bool operator<(const Candidate &other) const
+    {
+        if (rank != other.rank)
+            return rank < other.rank;
+        if (cost != other.cost)
+            return cost < other.cost;
+        return queuedAt < other.queuedAt;
+    }
+};
+
+}
+
+SyncQueue::SyncQueue()
+    : _agingStep(DEFAULT_AGING_STEP_MSEC)
+{
+}
+
+int SyncQueue::agingStep() const
+{
+    return _agingStep;
+}
+
+void SyncQueue::setAgingStep(int msecs)
+{
+    _agingStep = qMax(msecs, 1);
+}
+
+void SyncQueue::enqueue(const QString &alias, Folder::SyncTrigger trigger, int cost, qint64 now)
+{
+    QHash<QString, Entry>::iterator it = _entries.find(alias);
+    if (it == _entries.end()) {
+        Entry entry;
+        entry.trigger = trigger;
+        entry.cost = cost;
+        entry.queuedAt = now;
+        _entries.insert(alias, entry);
+        return;
+    }
+    it.value().trigger = qMin(it.value().trigger, int(trigger));
+    it.value().cost = cost;
+    it.value().queuedAt = qMin(it.value().queuedAt, now);
+}
+
+bool SyncQueue::contains(const QString &alias) const
+{
+    return _entries.contains(alias);
+}
+
+void SyncQueue::remove(const QString &alias)
+{
+    _entries.remove(alias);
+}
+
+int SyncQueue::size() const
+{
+    return _entries.size();
+}
+
+bool SyncQueue::isEmpty() const
+{
+    return _entries.isEmpty();
+}
+
+int SyncQueue::rank(const Entry &entry, qint64 now) const
+{
+    // not bounded, a folder which waited long enough gets
+    // ahead of everything queued after it
+    const qint64 steps = (now - entry.queuedAt) / _agingStep;
+    return int(entry.trigger - steps);
+}
+
+QStringList SyncQueue::ordered(qint64 now) const
+{
+    QList<Candidate> candidates;
+    QHash<QString, Entry>::const_iterator it;
+    for (it = _entries.constBegin(); it != _entries.constEnd(); ++it) {
+        Candidate candidate;
+        candidate.rank = rank(it.value(), now);
+        candidate.cost = it.value().cost;
+        candidate.queuedAt = it.value().queuedAt;
+        candidate.alias = it.key();
+        candidates.append(candidate);
+    }
+    qSort(candidates);
+
+    QStringList aliases;
+    foreach (const Candidate &candidate, candidates)
+        aliases.append(candidate.alias);
+    return aliases;
+}
+
+qint64 SyncQueue::take(const QString &alias, Folder::SyncTrigger *trigger)
+{
+    const Entry entry = _entries.take(alias);
+    if (trigger)
+        *trigger = Folder::SyncTrigger(entry.trigger);
+    return entry.queuedAt;
+}
+
+qint64 SyncQueue::queuedAt(const QString &alias) const
+{
+    return _entries.value(alias).queuedAt;
+}
+
+Folder::SyncTrigger SyncQueue::triggerOf(const QString &alias) const
+{
+    return Folder::SyncTrigger(_entries.value(alias).trigger);
+}
+
+int SyncQueue::costOf(const QString &alias) const
+{
+    return _entries.value(alias).cost;
+}
+
+void SyncQueue::recordWait(Folder::SyncTrigger trigger, int msecs)
+{
+    QList<int> &waits = _waits[trigger];
+    waits.append(msecs);
+    if (waits.size() > WAIT_HISTORY)
+        waits.removeFirst();
+}
+
+int SyncQueue::waitPercentile(Folder::SyncTrigger trigger, int percent) const
+{
+    QList<int> waits = _waits.value(trigger);
+    if (waits.isEmpty())
+        return -1;
+    qSort(waits);
+    const int i = qBound(0, (waits.size() * qBound(0, percent, 100) + 99) / 100 - 1, waits.size() - 1);
+    return waits.at(i);
+}
+
+}
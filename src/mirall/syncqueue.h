@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) by Duncan Mac-Vicar P. <duncan@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+
+#ifndef MIRALL_SYNCQUEUE_H
+#define MIRALL_SYNCQUEUE_H
+
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+#include "mirall/folder.h"
+
+namespace Mirall
+{
+
+/**
+ * The folders waiting for their sync, most urgent first
+ *
+ * Folders are ordered by what triggered their sync, local
+ * changes the user just made come before the initial syncs,
+ * which come before the syncs the poll timer asked for. Within
+ * a trigger the cheaper sync, the one with fewer changed paths,
+ * goes first, then the one waiting longer.
+ *
+ * Waiting moves a folder up by one trigger every agingStep()
+ * msecs, so a full scan can not starve behind a steady stream
+ * of local changes.
+ */
+class SyncQueue
+{
+public:
+    // cost of a sync of the whole folder
+    static const int FullSyncCost = 0x7fffffff;
+
+    SyncQueue();
+
+    int agingStep() const;
+    void setAgingStep(int msecs);
+
+    /**
+     * Adds the folder, or updates it if it waits already: it
+     * keeps the earlier queue time and the more urgent trigger.
+     * cost is the number of changed paths, or FullSyncCost.
+     */
+    void enqueue(const QString &alias, Folder::SyncTrigger trigger, int cost, qint64 now);
+
+    bool contains(const QString &alias) const;
+    void remove(const QString &alias);
+    int size() const;
+    bool isEmpty() const;
+
+    /**
+     * The queued folders, most urgent first
+     */
+    QStringList ordered(qint64 now) const;
+
+    /**
+     * Removes the folder, returns when it was queued and
+     * what triggered its sync.
+     */
+    qint64 take(const QString &alias, Folder::SyncTrigger *trigger);
+    qint64 queuedAt(const QString &alias) const;
+    Folder::SyncTrigger triggerOf(const QString &alias) const;
+    int costOf(const QString &alias) const;
+
+    /**
+     * Keeps the time a folder waited for its sync, the
+     * latest ones of each trigger are kept.
+     */
+    void recordWait(Folder::SyncTrigger trigger, int msecs);
+
+    /**
+     * The wait time in msecs percent of the recorded syncs of
+     * the trigger stayed below, -1 if none was recorded.
+     */
+    int waitPercentile(Folder::SyncTrigger trigger, int percent) const;
+
+private:
+    struct Entry {
+        int trigger;
+        int cost;
+        qint64 queuedAt;
+    };
+
+    // lower is more urgent
+    int rank(const Entry &entry, qint64 now) const;
+
+    QHash<QString, Entry> _entries;
+    int _agingStep;
+    QHash<int, QList<int> > _waits;
+};
+
+}
+
+#endif
@@ -68,6 +68,16 @@ QHash< QString, QStringList > SyncResult::syncChanges() const
     return _syncChanges;
 }
 
+void SyncResult::setProfile( const SyncProfile& profile )
+{
+    _profile = profile;
+}
+
+SyncProfile SyncResult::profile() const
+{
+    return _profile;
+}
+
 SyncResult::~SyncResult()
 {
 }
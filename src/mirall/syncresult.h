@@ -18,6 +18,8 @@
 #include <QStringList>
 #include <QHash>
 
+#include "mirall/syncprofile.h"
+
 namespace Mirall
 {
 
@@ -48,9 +50,17 @@ public:
     void setStatus( Status );
     Status status() const;
 
+    /**
+     * Timings of the phases of the run, empty if the folder
+     * type does not profile its syncs.
+     */
+    void setProfile( const SyncProfile& );
+    SyncProfile profile() const;
+
 private:
     Status _status;
     QHash<QString, QStringList> _syncChanges;
+    SyncProfile _profile;
 
     /**
      * when the sync tool support this...
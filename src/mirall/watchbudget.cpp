@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) by Duncan Mac-Vicar P. <duncan@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include <QDateTime>
+#include <QFile>
+#include <QMap>
+#include <QTime>
+
+#include <sys/stat.h>
+
+#include "mirall/watchbudget.h"
+
+namespace Mirall
+{
+
+// mtime of a directory in seconds, -1 if it is gone
+static qint64 directoryMTime(const QString &dir)
+{
+    struct stat st;
+    if (::stat(QFile::encodeName(dir).constData(), &st) != 0 || !S_ISDIR(st.st_mode))
+        return -1;
+    return qint64(st.st_mtime);
+}
+
+WatchBudget::WatchBudget()
+    : _limitReached(false)
+{
+}
+
+bool WatchBudget::limitReached() const
+{
+    return _limitReached;
+}
+
+void WatchBudget::setLimitReached(bool reached)
+{
+    _limitReached = reached;
+}
+
+bool WatchBudget::demote(const QString &dir)
+{
+    const qint64 mtime = directoryMTime(dir);
+    if (mtime == -1)
+        return false;
+
+    Polled polled;
+    polled.mtime = mtime;
+    polled.checkedAt = QDateTime::currentMSecsSinceEpoch() / 1000;
+    polled.lastChange = 0;
+    _polled.insert(dir, polled);
+    return true;
+}
+
+bool WatchBudget::remove(const QString &dir)
+{
+    return _polled.remove(dir) > 0;
+}
+
+int WatchBudget::removeTree(const QString &dir)
+{
+    int removed = _polled.remove(dir);
+    const QString prefix = dir + QLatin1Char('/');
+    QHash<QString, Polled>::iterator it = _polled.begin();
+    while (it != _polled.end()) {
+        if (it.key().startsWith(prefix)) {
+            it = _polled.erase(it);
+            removed++;
+        } else {
+            ++it;
+        }
+    }
+    return removed;
+}
+
+void WatchBudget::rename(const QString &from, const QString &to)
+{
+    const QString prefix = from + QLatin1Char('/');
+    QHash<QString, Polled> moved;
+    QHash<QString, Polled>::iterator it = _polled.begin();
+    while (it != _polled.end()) {
+        if (it.key() == from) {
+            moved.insert(to, it.value());
+        } else if (it.key().startsWith(prefix)) {
+            moved.insert(to + it.key().mid(from.length()), it.value());
+        } else {
+            ++it;
+            continue;
+        }
+        it = _polled.erase(it);
+    }
+    _polled.unite(moved);
+}
+
+bool WatchBudget::contains(const QString &dir) const
+{
+    return _polled.contains(dir);
+}
+
+QStringList WatchBudget::directories() const
+{
+    return _polled.keys();
+}
+
+int WatchBudget::count() const
+{
+    return _polled.size();
+}
+
+bool WatchBudget::check(QStringList *changed, QStringList *gone, int budget)
+{
+    if (_passQueue.isEmpty())
+        _passQueue = _polled.keys();
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QTime slice;
+    slice.start();
+    while (!_passQueue.isEmpty() && slice.elapsed() < budget) {
+        const QString dir = _passQueue.takeFirst();
+        QHash<QString, Polled>::iterator it = _polled.find(dir);
+        if (it == _polled.end())
+            continue; // dropped since the pass started
+
+        const qint64 mtime = directoryMTime(dir);
+        if (mtime == -1) {
+            gone->append(dir);
+            _polled.erase(it);
+            continue;
+        }
+        // the mtime has a resolution of a second, a directory
+        // changed in the second of the last check is reported
+        // once more to not miss a later change in that second.
+        Polled &polled = it.value();
+        if (mtime != polled.mtime || mtime >= polled.checkedAt) {
+            changed->append(dir);
+            polled.lastChange = now;
+        }
+        polled.mtime = mtime;
+        polled.checkedAt = now / 1000;
+    }
+    return _passQueue.isEmpty();
+}
+
+QStringList WatchBudget::hot(qint64 window) const
+{
+    const qint64 since = QDateTime::currentMSecsSinceEpoch() - window;
+    QMap<qint64, QString> byChange;
+    QHash<QString, Polled>::const_iterator it;
+    for (it = _polled.constBegin(); it != _polled.constEnd(); ++it) {
+        if (it.value().lastChange > since)
+            byChange.insertMulti(it.value().lastChange, it.key());
+    }
+
+    QStringList list;
+    QMap<qint64, QString>::const_iterator ci = byChange.constEnd();
+    while (ci != byChange.constBegin()) {
+        --ci;
+        list.append(ci.value());
+    }
+    return list;
+}
+
+}
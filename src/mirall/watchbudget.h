@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) by Duncan Mac-Vicar P. <duncan@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef MIRALL_WATCHBUDGET_H
+#define MIRALL_WATCHBUDGET_H
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+
+namespace Mirall
+{
+
+/**
+ * Keeps track of the directories which did not get an inotify
+ * watch because fs.inotify.max_user_watches is used up.
+ *
+ * Those directories are polled instead: their mtime is checked
+ * with one stat each, a change of the mtime means entries were
+ * added, removed or renamed. The time of the last change is kept
+ * to find the directories which deserve a watch more than the
+ * coldest watched ones.
+ */
+class WatchBudget
+{
+public:
+    WatchBudget();
+
+    /**
+     * Set once inotify_add_watch() failed with ENOSPC, no more
+     * watches are tried until one is released.
+     */
+    bool limitReached() const;
+    void setLimitReached(bool reached);
+
+    /**
+     * Starts polling dir, returns false if it does not exist
+     */
+    bool demote(const QString &dir);
+
+    /**
+     * Stops polling dir, returns false if it was not polled
+     */
+    bool remove(const QString &dir);
+
+    /**
+     * Stops polling dir and everything below, returns the
+     * number of directories dropped.
+     */
+    int removeTree(const QString &dir);
+
+    /**
+     * Follows a renamed directory, polled directories below
+     * from are moved below to.
+     */
+    void rename(const QString &from, const QString &to);
+
+    bool contains(const QString &dir) const;
+    QStringList directories() const;
+    int count() const;
+
+    /**
+     * Stats polled directories for at most budget msecs. The
+     * ones whose mtime changed are appended to changed, the ones
+     * which are gone are dropped and appended to gone. Returns
+     * true once the pass covered every directory, the next call
+     * starts a new pass.
+     */
+    bool check(QStringList *changed, QStringList *gone, int budget);
+
+    /**
+     * Polled directories which changed during the last
+     * window msecs, the most recently changed first.
+     */
+    QStringList hot(qint64 window) const;
+
+private:
+    struct Polled {
+        qint64 mtime;
+        // seconds since epoch of the last check
+        qint64 checkedAt;
+        // msecs since epoch of the last change seen, 0 if none
+        qint64 lastChange;
+    };
+
+    QHash<QString, Polled> _polled;
+    // directories still to check in the current pass
+    QStringList _passQueue;
+    bool _limitReached;
+};
+
+}
+
+#endif
@@ -0,0 +1,335 @@
+/*
+ * Copyright (C) by Duncan Mac-Vicar P. <duncan@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "mirall/watchtable.h"
+
+namespace Mirall
+{
+
+// node 0 is the file system root "/"
+static const int RootNode = 0;
+
+WatchTable::WatchTable()
+{
+    clear();
+}
+
+void WatchTable::clear()
+{
+    _nodes.clear();
+    _freeNodes.clear();
+    _children.clear();
+    _byDescriptor.clear();
+
+    Node root;
+    root.parent = -1;
+    root.wd = -1;
+    root.children = 0;
+    root.firstChild = -1;
+    root.nextSibling = -1;
+    root.prevSibling = -1;
+    root.lastEvent = 0;
+    _nodes.append(root);
+}
+
+int WatchTable::lookup(const QString &path) const
+{
+    int node = RootNode;
+    const QStringList components = path.split(QLatin1Char('/'), QString::SkipEmptyParts);
+    foreach (const QString &name, components) {
+        node = _children.value(ChildKey(node, name), -1);
+        if (node == -1)
+            return -1;
+    }
+    return node;
+}
+
+QString WatchTable::buildPath(int node) const
+{
+    if (node == RootNode)
+        return QLatin1String("/");
+
+    QStringList components;
+    while (node != RootNode) {
+        components.prepend(_nodes.at(node).name);
+        node = _nodes.at(node).parent;
+    }
+    return QString::fromLatin1("/") + components.join(QLatin1String("/"));
+}
+
+void WatchTable::link(int node, int parent)
+{
+    Node &n = _nodes[node];
+    n.parent = parent;
+    n.prevSibling = -1;
+    n.nextSibling = _nodes.at(parent).firstChild;
+    if (n.nextSibling != -1)
+        _nodes[n.nextSibling].prevSibling = node;
+    _nodes[parent].firstChild = node;
+    _nodes[parent].children++;
+    _children.insert(ChildKey(parent, n.name), node);
+}
+
+void WatchTable::unlink(int node)
+{
+    Node &n = _nodes[node];
+    _children.remove(ChildKey(n.parent, n.name));
+    if (n.prevSibling != -1)
+        _nodes[n.prevSibling].nextSibling = n.nextSibling;
+    else
+        _nodes[n.parent].firstChild = n.nextSibling;
+    if (n.nextSibling != -1)
+        _nodes[n.nextSibling].prevSibling = n.prevSibling;
+    _nodes[n.parent].children--;
+    n.parent = -1;
+    n.prevSibling = -1;
+    n.nextSibling = -1;
+}
+
+int WatchTable::ensure(const QString &path)
+{
+    int node = RootNode;
+    const QStringList components = path.split(QLatin1Char('/'), QString::SkipEmptyParts);
+    foreach (const QString &name, components) {
+        int child = _children.value(ChildKey(node, name), -1);
+        if (child == -1) {
+            Node n;
+            n.parent = -1;
+            n.wd = -1;
+            n.children = 0;
+            n.firstChild = -1;
+            n.nextSibling = -1;
+            n.prevSibling = -1;
+            n.lastEvent = 0;
+            n.name = name;
+            if (_freeNodes.isEmpty()) {
+                child = _nodes.size();
+                _nodes.append(n);
+            } else {
+                child = _freeNodes.last();
+                _freeNodes.pop_back();
+                _nodes[child] = n;
+            }
+            link(child, node);
+        }
+        node = child;
+    }
+    return node;
+}
+
+void WatchTable::insert(const QString &path, int wd)
+{
+    const int node = ensure(path);
+
+    Node &n = _nodes[node];
+    if (n.wd != -1)
+        _byDescriptor.remove(n.wd);
+    n.wd = wd;
+    _byDescriptor.insert(wd, node);
+}
+
+// drops the node and all ancestors which are only left
+// as path components
+void WatchTable::release(int node)
+{
+    while (node != RootNode && _nodes.at(node).wd == -1 && _nodes.at(node).children == 0) {
+        const int parent = _nodes.at(node).parent;
+        unlink(node);
+        _nodes[node].name.clear();
+        _nodes[node].lastEvent = 0;
+        _freeNodes.append(node);
+        node = parent;
+    }
+}
+
+int WatchTable::remove(const QString &path)
+{
+    const int node = lookup(path);
+    if (node == -1 || _nodes.at(node).wd == -1)
+        return -1;
+
+    const int wd = _nodes.at(node).wd;
+    _byDescriptor.remove(wd);
+    _nodes[node].wd = -1;
+    release(node);
+    return wd;
+}
+
+bool WatchTable::removeDescriptor(int wd)
+{
+    const int node = _byDescriptor.value(wd, -1);
+    if (node == -1)
+        return false;
+
+    _byDescriptor.remove(wd);
+    _nodes[node].wd = -1;
+    release(node);
+    return true;
+}
+
+QList<int> WatchTable::removeTree(const QString &path)
+{
+    QList<int> wds;
+    const int top = lookup(path);
+    if (top == -1 || top == RootNode)
+        return wds;
+
+    // everything below top is dropped as a whole, top itself
+    // is released like a single node afterwards.
+    QList<int> stack;
+    stack.append(top);
+    while (!stack.isEmpty()) {
+        const int node = stack.takeLast();
+        Node &n = _nodes[node];
+        if (n.wd != -1) {
+            wds.append(n.wd);
+            _byDescriptor.remove(n.wd);
+            n.wd = -1;
+        }
+        for (int child = n.firstChild; child != -1; child = _nodes.at(child).nextSibling)
+            stack.append(child);
+        if (node != top) {
+            _children.remove(ChildKey(n.parent, n.name));
+            n.parent = -1;
+            n.firstChild = -1;
+            n.children = 0;
+            n.name.clear();
+            n.lastEvent = 0;
+            _freeNodes.append(node);
+        }
+    }
+    _nodes[top].firstChild = -1;
+    _nodes[top].children = 0;
+    release(top);
+    return wds;
+}
+
+bool WatchTable::rename(const QString &from, const QString &to)
+{
+    const int node = lookup(from);
+    if (node == -1 || node == RootNode || lookup(to) != -1)
+        return false;
+
+    const int slash = to.lastIndexOf(QLatin1Char('/'));
+    const QString name = to.mid(slash + 1);
+    if (name.isEmpty())
+        return false;
+
+    const int oldParent = _nodes.at(node).parent;
+    unlink(node);
+    // keep the old parent alive until the node is linked
+    // again, the new parent might be below it.
+    _nodes[oldParent].children++;
+    const int newParent = ensure(to.left(slash));
+    _nodes[oldParent].children--;
+
+    _nodes[node].name = name;
+    link(node, newParent);
+    release(oldParent);
+    return true;
+}
+
+QList<int> WatchTable::descriptorsBelow(const QString &path) const
+{
+    QList<int> wds;
+    const int top = lookup(path);
+    if (top == -1)
+        return wds;
+
+    QList<int> stack;
+    stack.append(top);
+    while (!stack.isEmpty()) {
+        const Node &n = _nodes.at(stack.takeLast());
+        if (n.wd != -1)
+            wds.append(n.wd);
+        for (int child = n.firstChild; child != -1; child = _nodes.at(child).nextSibling)
+            stack.append(child);
+    }
+    return wds;
+}
+
+bool WatchTable::contains(const QString &path) const
+{
+    return descriptor(path) != -1;
+}
+
+int WatchTable::descriptor(const QString &path) const
+{
+    const int node = lookup(path);
+    if (node == -1)
+        return -1;
+    return _nodes.at(node).wd;
+}
+
+QString WatchTable::path(int wd) const
+{
+    const int node = _byDescriptor.value(wd, -1);
+    if (node == -1)
+        return QString();
+    return buildPath(node);
+}
+
+void WatchTable::touch(int wd, qint64 time)
+{
+    const int node = _byDescriptor.value(wd, -1);
+    if (node != -1)
+        _nodes[node].lastEvent = time;
+}
+
+qint64 WatchTable::lastEvent(const QString &path) const
+{
+    const int node = lookup(path);
+    if (node == -1)
+        return 0;
+    return _nodes.at(node).lastEvent;
+}
+
+qint64 WatchTable::lastEvent(int wd) const
+{
+    const int node = _byDescriptor.value(wd, -1);
+    if (node == -1)
+        return 0;
+    return _nodes.at(node).lastEvent;
+}
+
+int WatchTable::walk(int cursor, int count, QList<int> *wds) const
+{
+    const int end = qMin(_nodes.size(), cursor + count);
+    for (int node = cursor; node < end; ++node) {
+        if (_nodes.at(node).wd != -1)
+            wds->append(_nodes.at(node).wd);
+    }
+    return end < _nodes.size() ? end : -1;
+}
+
+QList<int> WatchTable::descriptors() const
+{
+    return _byDescriptor.keys();
+}
+
+QStringList WatchTable::paths() const
+{
+    QStringList list;
+    QHash<int, int>::const_iterator it;
+    for (it = _byDescriptor.constBegin(); it != _byDescriptor.constEnd(); ++it)
+        list.append(buildPath(it.value()));
+    return list;
+}
+
+int WatchTable::count() const
+{
+    return _byDescriptor.size();
+}
+
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) by Duncan Mac-Vicar P. <duncan@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef MIRALL_WATCHTABLE_H
+#define MIRALL_WATCHTABLE_H
+
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+namespace Mirall
+{
+
+/**
+ * Maps inotify watch descriptors to absolute directory paths
+ * and back.
+ *
+ * Directories are stored as a tree of name components, each
+ * node only knows its parent and its own name, so the memory
+ * grows with the tree and not with the length of the paths.
+ *
+ * wd -> path is a hash lookup plus walking up to the root,
+ * path -> wd is one hash lookup per path component.
+ */
+class WatchTable
+{
+public:
+    WatchTable();
+
+    /**
+     * Adds or updates the watch descriptor of a path
+     */
+    void insert(const QString &path, int wd);
+
+    /**
+     * Removes the path, returns its watch descriptor or -1
+     */
+    int remove(const QString &path);
+
+    /**
+     * Removes the watch descriptor, returns false if unknown
+     */
+    bool removeDescriptor(int wd);
+
+    /**
+     * Removes path and everything below it, returns the
+     * watch descriptors which were removed.
+     */
+    QList<int> removeTree(const QString &path);
+
+    /**
+     * Moves the subtree at from to to, the nodes below keep
+     * their watch descriptors. Returns false if from is not
+     * known or something is already known at to.
+     */
+    bool rename(const QString &from, const QString &to);
+
+    /**
+     * Watch descriptors of path and of everything below it
+     */
+    QList<int> descriptorsBelow(const QString &path) const;
+
+    bool contains(const QString &path) const;
+
+    /**
+     * Watch descriptor of the path, -1 if not watched
+     */
+    int descriptor(const QString &path) const;
+
+    /**
+     * Path of the watch descriptor, empty if unknown
+     */
+    QString path(int wd) const;
+
+    /**
+     * Records the time (msecs since epoch) of the latest event
+     * seen for the watch descriptor.
+     */
+    void touch(int wd, qint64 time);
+
+    /**
+     * Time of the latest event of a watched path, 0 if none
+     */
+    qint64 lastEvent(const QString &path) const;
+    qint64 lastEvent(int wd) const;
+
+    /**
+     * Walks the watched paths in chunks without building them:
+     * appends the watch descriptors of up to count nodes from
+     * cursor on to wds. Returns the cursor of the next chunk,
+     * -1 once the whole table was walked. Paths added or removed
+     * in between may be missed.
+     */
+    int walk(int cursor, int count, QList<int> *wds) const;
+
+    QList<int> descriptors() const;
+    QStringList paths() const;
+    int count() const;
+    void clear();
+
+private:
+    struct Node {
+        int parent;
+        int wd;
+        int children;
+        int firstChild;
+        int nextSibling;
+        int prevSibling;
+        qint64 lastEvent;
+        QString name;
+    };
+    typedef QPair<int, QString> ChildKey;
+
+    int lookup(const QString &path) const;
+    // looks up the path, missing components are created
+    int ensure(const QString &path);
+    QString buildPath(int node) const;
+    void link(int node, int parent);
+    void unlink(int node);
+    void release(int node);
+
+    QVector<Node> _nodes;
+    QVector<int> _freeNodes;
+    QHash<ChildKey, int> _children;
+    QHash<int, int> _byDescriptor;
+};
+
+}
+
+#endif
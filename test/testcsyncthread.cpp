@@ -0,0 +1,47 @@
+#include <QDebug>
+
+#include "mirall/csyncthread.h"
+#include "testcsyncthread.h"
+
+using Mirall::CSyncThread;
+
+void TestCSyncThread::testSyncPaths()
+{
+    CSyncThread thread("/data/src", "/data/dst");
+    QVERIFY(thread.syncPaths().isEmpty());
+
+    // sorted, paths below another one and outside of the
+    // source are dropped. "a/bc" is not below "a/b".
+    thread.setSyncPaths(QStringList() << "/data/src/b/x" << "/data/src/a/bc"
+                        << "/data/src/a/b/c" << "/data/src/a/b" << "/elsewhere/f");
+    QCOMPARE(thread.syncPaths(),
+             QStringList() << "/data/src/a/b" << "/data/src/a/bc" << "/data/src/b/x");
+
+    // the root means everything
+    thread.setSyncPaths(QStringList() << "/data/src/a" << "/data/src");
+    QVERIFY(thread.syncPaths().isEmpty());
+    thread.setSyncPaths(QStringList() << "/data/src/");
+    QVERIFY(thread.syncPaths().isEmpty());
+}
+
+void TestCSyncThread::testInScope()
+{
+    QStringList scope;
+    QVERIFY(CSyncThread::inScope(scope, "anything"));
+
+    scope << "a/b" << "a/b-c" << "d";
+    QVERIFY(CSyncThread::inScope(scope, "a/b"));
+    QVERIFY(CSyncThread::inScope(scope, "d/e/f"));
+    QVERIFY(CSyncThread::inScope(scope, "a/b-c/y"));
+    // "a/b-c" sorts between "a/b" and "a/b/x"
+    QVERIFY(CSyncThread::inScope(scope, "a/b/x"));
+
+    // a common prefix is no parent folder
+    QVERIFY(!CSyncThread::inScope(scope, "a/bc"));
+    QVERIFY(!CSyncThread::inScope(scope, "dd"));
+    QVERIFY(!CSyncThread::inScope(scope, "a"));
+    QVERIFY(!CSyncThread::inScope(scope, "c"));
+}
+
+QTEST_MAIN(TestCSyncThread)
+#include "testcsyncthread.moc"
@@ -0,0 +1,19 @@
+#ifndef MIRALL_TEST_CSYNCTHREAD_H
+#define MIRALL_TEST_CSYNCTHREAD_H
+
+#include <QtTest/QtTest>
+
+class TestCSyncThread : public QObject
+{
+    Q_OBJECT
+public:
+
+private slots:
+    void testSyncPaths();
+    void testInScope();
+
+private:
+};
+
+
+#endif
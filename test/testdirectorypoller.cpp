@@ -0,0 +1,81 @@
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+
+#include "mirall/directorypoller.h"
+#include "mirall/fileutils.h"
+#include "mirall/temporarydir.h"
+#include "testdirectorypoller.h"
+
+static QStringList pollAll(Mirall::DirectoryPoller *poller)
+{
+    QStringList changed;
+    while (!poller->poll(&changed, 1000))
+        ;
+    return changed;
+}
+
+static void touch(const QString &path)
+{
+    QFile file(path);
+    file.open(QIODevice::WriteOnly);
+    file.close();
+}
+
+void TestDirectoryPoller::testChanges()
+{
+    Mirall::TemporaryDir tmp;
+    QDir dir(tmp.path());
+    QVERIFY(dir.mkpath("a/b"));
+    touch(tmp.path() + "/a/old.txt");
+
+    Mirall::DirectoryPoller poller(tmp.path());
+    // the first pass only takes the snapshot
+    QVERIFY(pollAll(&poller).isEmpty());
+    QVERIFY(poller.isPrimed());
+    QCOMPARE(poller.directoryCount(), 3);
+
+    touch(tmp.path() + "/a/b/new.txt");
+    QVERIFY(dir.remove("a/old.txt"));
+    QVERIFY(dir.mkpath("c/d"));
+    touch(tmp.path() + "/c/d/deep.txt");
+
+    QStringList changed = pollAll(&poller);
+    qDebug() << changed;
+    QVERIFY(changed.contains(tmp.path() + "/a/b/new.txt"));
+    QVERIFY(changed.contains(tmp.path() + "/a/old.txt"));
+    QVERIFY(changed.contains(tmp.path() + "/c"));
+    // new folders are listed in the same pass
+    QVERIFY(changed.contains(tmp.path() + "/c/d/deep.txt"));
+    QCOMPARE(poller.directoryCount(), 5);
+
+    QVERIFY(Mirall::FileUtils::removeDir(tmp.path() + "/c"));
+    changed = pollAll(&poller);
+    QVERIFY(changed.contains(tmp.path() + "/c"));
+    QCOMPARE(poller.directoryCount(), 3);
+}
+
+void TestDirectoryPoller::testUnchangedFoldersNotListed()
+{
+    Mirall::TemporaryDir tmp;
+    QDir dir(tmp.path());
+    for (int i = 0; i < 20; ++i)
+        QVERIFY(dir.mkpath(QString("dir%1").arg(i)));
+
+    Mirall::DirectoryPoller poller(tmp.path());
+    pollAll(&poller);
+    QCOMPARE(poller.lastPassListings(), 21);
+
+    // listings taken in the second of a change are repeated once
+    QTest::qWait(1100);
+    pollAll(&poller);
+    QTest::qWait(1100);
+    touch(tmp.path() + "/dir7/file");
+    QStringList changed = pollAll(&poller);
+    QCOMPARE(changed, QStringList() << tmp.path() + "/dir7/file");
+    QVERIFY(poller.lastPassListings() < 21);
+}
+
+QTEST_MAIN(TestDirectoryPoller)
+#include "testdirectorypoller.moc"
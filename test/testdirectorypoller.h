@@ -0,0 +1,19 @@
+#ifndef MIRALL_TEST_DIRECTORYPOLLER_H
+#define MIRALL_TEST_DIRECTORYPOLLER_H
+
+#include <QtTest/QtTest>
+
+class TestDirectoryPoller : public QObject
+{
+    Q_OBJECT
+public:
+
+private slots:
+    void testChanges();
+    void testUnchangedFoldersNotListed();
+
+private:
+};
+
+
+#endif
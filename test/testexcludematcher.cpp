@@ -0,0 +1,113 @@
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QRegExp>
+
+#include "mirall/excludematcher.h"
+#include "testexcludematcher.h"
+
+// the patterns of the exclude.lst shipped with mirall
+static const char *defaultPatterns[] = {
+    "*.filepart", "*~", "*.bak", "*.part", "*.unison*",
+    "*csync_timedif.ctmp*", ".*.sw?", ".*.*sw?", 0
+};
+
+void TestExcludeMatcher::initTestCase()
+{
+    for (int i = 0; defaultPatterns[i]; ++i)
+        _patterns << QString::fromLatin1(defaultPatterns[i]);
+    // a large exclude list
+    for (int i = 0; i < 200; ++i) {
+        _patterns << QString::fromLatin1("*.ext%1").arg(i);
+        _patterns << QString::fromLatin1("build-%1*").arg(i);
+        _patterns << QString::fromLatin1("cache%1").arg(i);
+    }
+
+    for (int i = 0; i < 1000; ++i) {
+        _paths << QString::fromLatin1("/home/user/ownCloud/dir%1/document%2.odt").arg(i % 37).arg(i);
+    }
+    _paths << "/home/user/ownCloud/foo.bak" << "/home/user/ownCloud/.foo.swp";
+}
+
+void TestExcludeMatcher::cleanupTestCase()
+{
+}
+
+void TestExcludeMatcher::testMatches()
+{
+    Mirall::ExcludeMatcher matcher;
+    foreach (const QString &pattern, _patterns)
+        matcher.addPattern(pattern);
+
+    QCOMPARE(matcher.patternCount(), _patterns.size());
+
+    QVERIFY(matcher.isExcluded("/home/user/ownCloud/file.filepart"));
+    QVERIFY(matcher.isExcluded("/home/user/ownCloud/file.txt~"));
+    QVERIFY(matcher.isExcluded("/home/user/ownCloud/.file.txt.swp"));
+    QVERIFY(matcher.isExcluded("/home/user/ownCloud/a.unison.tmp"));
+    QVERIFY(matcher.isExcluded("/home/user/ownCloud/build-12-debug"));
+    QVERIFY(matcher.isExcluded("/home/user/ownCloud/cache7"));
+    QVERIFY(matcher.isExcluded("/home/user/ownCloud/cache7/"));
+    QVERIFY(matcher.isExcluded("/home/user/ownCloud/x.ext199"));
+
+    QVERIFY(!matcher.isExcluded("/home/user/ownCloud/file.txt"));
+    QVERIFY(!matcher.isExcluded("/home/user/ownCloud/cache7x"));
+    QVERIFY(!matcher.isExcluded("/home/user/ownCloud/bak"));
+    QVERIFY(!matcher.isExcluded("/home/user/ownCloud/x.ext200"));
+
+    matcher.clear();
+    QVERIFY(!matcher.isExcluded("/home/user/ownCloud/file.filepart"));
+}
+
+void TestExcludeMatcher::benchmarkMatcher()
+{
+    Mirall::ExcludeMatcher matcher;
+    foreach (const QString &pattern, _patterns)
+        matcher.addPattern(pattern);
+
+    int excluded = 0;
+    qint64 checked = 0;
+    QElapsedTimer timer;
+    timer.start();
+    QBENCHMARK {
+        checked += _paths.size();
+        foreach (const QString &path, _paths) {
+            if (matcher.isExcluded(path))
+                excluded++;
+        }
+    }
+    qint64 msecs = qMax(qint64(1), timer.elapsed());
+    qDebug() << "ExcludeMatcher:" << checked * 1000 / msecs << "matches per second against"
+             << _patterns.size() << "patterns";
+    QVERIFY(excluded > 0);
+}
+
+// the way the folder watcher matched before: one QRegExp per
+// pattern, built for every single event.
+void TestExcludeMatcher::benchmarkRegExpLoop()
+{
+    int excluded = 0;
+    qint64 checked = 0;
+    QElapsedTimer timer;
+    timer.start();
+    QBENCHMARK {
+        checked += _paths.size();
+        foreach (const QString &path, _paths) {
+            foreach (const QString &pattern, _patterns) {
+                QRegExp regexp(pattern);
+                regexp.setPatternSyntax(QRegExp::Wildcard);
+                if (regexp.exactMatch(path)) {
+                    excluded++;
+                    break;
+                }
+            }
+        }
+    }
+    qint64 msecs = qMax(qint64(1), timer.elapsed());
+    qDebug() << "QRegExp loop:" << checked * 1000 / msecs << "matches per second against"
+             << _patterns.size() << "patterns";
+    QVERIFY(excluded > 0);
+}
+
+QTEST_MAIN(TestExcludeMatcher)
+#include "testexcludematcher.moc"
@@ -0,0 +1,26 @@
+
+#ifndef MIRALL_TEST_EXCLUDEMATCHER_H
+#define MIRALL_TEST_EXCLUDEMATCHER_H
+
+#include <QtTest/QtTest>
+
+class TestExcludeMatcher : public QObject
+{
+    Q_OBJECT
+public:
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void testMatches();
+    void benchmarkMatcher();
+    void benchmarkRegExpLoop();
+
+private:
+    QStringList _patterns;
+    QStringList _paths;
+};
+
+
+#endif
@@ -0,0 +1,110 @@
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QMutex>
+
+#include "mirall/fileutils.h"
+#include "mirall/temporarydir.h"
+#include "testfileutils.h"
+
+using Mirall::FileUtils;
+
+class CollectingVisitor : public FileUtils::ScanVisitor
+{
+public:
+    CollectingVisitor(const QString &prune = QString()) : _prune(prune) {}
+
+    bool visit(const QString &dir, const char *name,
+               FileUtils::EntryType type, const struct stat *)
+    {
+        const QString path = dir + QLatin1Char('/') + QFile::decodeName(name);
+        QMutexLocker lock(&_mutex);
+        if (type == FileUtils::DirEntry)
+            dirs.append(path);
+        else
+            files.append(path);
+        return QFile::decodeName(name) != _prune;
+    }
+
+    QStringList dirs;
+    QStringList files;
+
+private:
+    QString _prune;
+    QMutex _mutex;
+};
+
+static void createTree(const QString &root)
+{
+    QDir dir(root);
+    QVERIFY(dir.mkpath("a/b/c"));
+    QVERIFY(dir.mkpath("skip/deep"));
+    QVERIFY(dir.mkpath("d"));
+    QVERIFY(dir.mkpath(".cache/sub"));
+    const char *files[] = { "f1", "a/f2", "a/b/c/f3", "skip/deep/f4", "d/.hidden", 0 };
+    for (int i = 0; files[i]; ++i) {
+        QFile file(root + "/" + files[i]);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.close();
+    }
+}
+
+void TestFileUtils::initTestCase()
+{
+}
+
+void TestFileUtils::cleanupTestCase()
+{
+}
+
+void TestFileUtils::testScanDirectory()
+{
+    Mirall::TemporaryDir tmp;
+    createTree(tmp.path());
+
+    CollectingVisitor flat;
+    QVERIFY(FileUtils::scanDirectory(tmp.path(), &flat));
+    QCOMPARE(flat.dirs.size(), 4);
+    QCOMPARE(flat.files.size(), 1);
+
+    // "skip" is reported but not descended into
+    CollectingVisitor visitor("skip");
+    QVERIFY(FileUtils::scanDirectory(tmp.path(), &visitor, FileUtils::ScanRecursive));
+    QVERIFY(visitor.dirs.contains(tmp.path() + "/a/b/c"));
+    QVERIFY(visitor.dirs.contains(tmp.path() + "/skip"));
+    QVERIFY(!visitor.dirs.contains(tmp.path() + "/skip/deep"));
+    QVERIFY(visitor.files.contains(tmp.path() + "/a/b/c/f3"));
+    QVERIFY(visitor.files.contains(tmp.path() + "/d/.hidden"));
+    QCOMPARE(visitor.files.size(), 4);
+
+    QStringList subFolders = FileUtils::subFoldersList(tmp.path(), FileUtils::SubFolderRecursive);
+    QCOMPARE(subFolders.size(), 6);
+    // hidden folders are left out, like QDir does
+    QVERIFY(!subFolders.contains(tmp.path() + "/.cache"));
+    QVERIFY(!subFolders.contains(tmp.path() + "/.cache/sub"));
+}
+
+void TestFileUtils::testScanParallel()
+{
+    Mirall::TemporaryDir tmp;
+    createTree(tmp.path());
+
+    CollectingVisitor visitor;
+    QVERIFY(FileUtils::scanDirectory(tmp.path(), &visitor,
+                                     FileUtils::ScanRecursive | FileUtils::ScanParallel));
+    QCOMPARE(visitor.dirs.size(), 8);
+    QCOMPARE(visitor.files.size(), 5);
+}
+
+void TestFileUtils::testRemoveDir()
+{
+    Mirall::TemporaryDir tmp;
+    createTree(tmp.path() + "/tree");
+
+    QVERIFY(FileUtils::removeDir(tmp.path() + "/tree"));
+    QVERIFY(!QDir(tmp.path() + "/tree").exists());
+}
+
+QTEST_MAIN(TestFileUtils)
+#include "testfileutils.moc"
@@ -0,0 +1,24 @@
+
+#ifndef MIRALL_TEST_FILEUTILS_H
+#define MIRALL_TEST_FILEUTILS_H
+
+#include <QtTest/QtTest>
+
+class TestFileUtils : public QObject
+{
+    Q_OBJECT
+public:
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void testScanDirectory();
+    void testScanParallel();
+    void testRemoveDir();
+
+private:
+};
+
+
+#endif
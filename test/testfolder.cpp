@@ -0,0 +1,115 @@
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QTextStream>
+
+#include "mirall/folder.h"
+#include "mirall/inotify.h"
+#include "mirall/syncqueue.h"
+#include "mirall/temporarydir.h"
+#include "testfolder.h"
+
+using namespace Mirall;
+
+// a folder which never syncs, its spool only grows
+class SpoolFolder : public Folder
+{
+public:
+    SpoolFolder(const QString &path)
+        : Folder("spool", path, QString())
+    {
+    }
+
+    void startSync(const QStringList &pathList)
+    {
+        Q_UNUSED(pathList);
+    }
+
+    bool isBusy() const
+    {
+        return false;
+    }
+};
+
+static QStringList readLines(const QString &fileName)
+{
+    QStringList lines;
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return lines;
+    QTextStream in(&file);
+    in.setCodec("UTF-8");
+    while (!in.atEnd())
+        lines << in.readLine();
+    return lines;
+}
+
+void TestFolder::testSpoolSaved()
+{
+    Mirall::INotify::initialize();
+    Mirall::TemporaryDir tmp;
+    QVERIFY(QDir(tmp.path()).mkdir("folder"));
+    const QString path = tmp.path() + "/folder";
+    const QString spoolFile = tmp.path() + "/spool";
+
+    SpoolFolder *folder = new SpoolFolder(path);
+    folder->setSpoolFile(spoolFile);
+    folder->slotChanged(QStringList() << path + "/a" << path + "/b/c");
+    delete folder;
+
+    // saved on exit, with a path of a sibling folder added
+    QStringList lines = readLines(spoolFile);
+    QCOMPARE(lines.size(), 2);
+    QVERIFY(lines.contains(path + "/a"));
+    QVERIFY(lines.contains(path + "/b/c"));
+    QFile file(spoolFile);
+    QVERIFY(file.open(QIODevice::Append));
+    file.write(QString(path + "-other/d\n").toUtf8());
+    file.close();
+
+    // loading takes the file, the sibling's path is dropped
+    folder = new SpoolFolder(path);
+    folder->setSpoolFile(spoolFile);
+    QVERIFY(!QFile::exists(spoolFile));
+    QCOMPARE(folder->spooledTrigger(), Folder::StartupTrigger);
+    QStringList paths = folder->takeSpooledPaths();
+    paths.sort();
+    QCOMPARE(paths, QStringList() << path + "/a" << path + "/b/c");
+
+    // the paths of the running sync are checkpointed until it
+    // succeeded
+    lines = readLines(spoolFile);
+    lines.sort();
+    QCOMPARE(lines, paths);
+    delete folder;
+
+    Mirall::INotify::cleanup();
+}
+
+void TestFolder::testFullSpoolSaved()
+{
+    Mirall::INotify::initialize();
+    Mirall::TemporaryDir tmp;
+    QVERIFY(QDir(tmp.path()).mkdir("folder"));
+    const QString path = tmp.path() + "/folder";
+    const QString spoolFile = tmp.path() + "/spool";
+
+    SpoolFolder *folder = new SpoolFolder(path);
+    folder->setSpoolFile(spoolFile);
+    folder->slotChanged(QStringList() << path + "/a");
+    // the whole folder covers every path
+    folder->slotChanged(QStringList());
+    delete folder;
+    QCOMPARE(readLines(spoolFile), QStringList() << path);
+
+    folder = new SpoolFolder(path);
+    folder->setSpoolFile(spoolFile);
+    QCOMPARE(folder->spooledCost(), int(SyncQueue::FullSyncCost));
+    QVERIFY(folder->takeSpooledPaths().isEmpty());
+    delete folder;
+
+    Mirall::INotify::cleanup();
+}
+
+QTEST_MAIN(TestFolder)
+#include "testfolder.moc"
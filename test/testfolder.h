@@ -0,0 +1,19 @@
+#ifndef MIRALL_TEST_FOLDER_H
+#define MIRALL_TEST_FOLDER_H
+
+#include <QtTest/QtTest>
+
+class TestFolder : public QObject
+{
+    Q_OBJECT
+public:
+
+private slots:
+    void testSpoolSaved();
+    void testFullSpoolSaved();
+
+private:
+};
+
+
+#endif
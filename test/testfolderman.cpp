@@ -0,0 +1,100 @@
+#include <QDebug>
+
+#include "mirall/folderman.h"
+#include "mirall/syncresult.h"
+#include "mirall/temporarydir.h"
+#include "testfolderman.h"
+
+using namespace Mirall;
+
+// a folder whose sync only ends when the test says so
+class FakeFolder : public Folder
+{
+public:
+    FakeFolder(const QString &alias, const QString &path, const QString &secondPath)
+        : Folder(alias, path, secondPath), syncs(0), _busy(false)
+    {
+    }
+
+    void startSync(const QStringList &pathList)
+    {
+        Q_UNUSED(pathList);
+        syncs++;
+        _busy = true;
+    }
+
+    bool isBusy() const
+    {
+        return _busy;
+    }
+
+    void finish()
+    {
+        _busy = false;
+        emit syncFinished(SyncResult(SyncResult::Success));
+    }
+
+    int syncs;
+
+private:
+    bool _busy;
+};
+
+void TestFolderMan::testServerLimits()
+{
+    Mirall::TemporaryDir tmp;
+    FolderMan man;
+    man.setMaxParallelSyncs(2);
+    man.setMaxSyncsPerServer(1);
+
+    // the default ports make a and b the same server, c talks
+    // to another port and d has a local target.
+    const char *urls[] = { "https://srv/a", "ownclouds://srv:443/b", "owncloud://srv/c", "/backup/d", 0 };
+    QList<FakeFolder *> folders;
+    for (int i = 0; urls[i]; ++i) {
+        const QString alias = QString(QChar('a' + i));
+        QVERIFY(QDir(tmp.path()).mkdir(alias));
+        FakeFolder *f = new FakeFolder(alias, tmp.path() + "/" + alias, urls[i]);
+        man.addFolder(f);
+        folders.append(f);
+    }
+    FakeFolder *a = folders.at(0);
+    FakeFolder *b = folders.at(1);
+    FakeFolder *c = folders.at(2);
+    FakeFolder *d = folders.at(3);
+
+    foreach (FakeFolder *f, folders)
+        f->slotChanged(QStringList() << f->path() + "/file");
+
+    // b waits for a, d for a free slot
+    QCOMPARE(a->syncs, 1);
+    QCOMPARE(b->syncs, 0);
+    QCOMPARE(c->syncs, 1);
+    QCOMPARE(d->syncs, 0);
+    QCOMPARE(man.runningFolders().size(), 2);
+    QCOMPARE(man.queueDepth(), 2);
+
+    // a local target only counts for the parallel limit
+    man.setMaxParallelSyncs(3);
+    QCOMPARE(d->syncs, 1);
+    QCOMPARE(b->syncs, 0);
+
+    // removing a running folder waits for its sync
+    man.slotRemoveFolder("a");
+    QVERIFY(man.folder("a") == a);
+    a->finish();
+    QVERIFY(man.folder("a") == 0);
+    QVERIFY(!man.runningFolders().contains("a"));
+
+    // the server of a is free for b now
+    QCoreApplication::processEvents();
+    QCOMPARE(b->syncs, 1);
+    QCOMPARE(man.queueDepth(), 0);
+    QCOMPARE(man.runningFolders().size(), 3);
+
+    c->finish();
+    QCOMPARE(man.runningFolders().size(), 2);
+}
+
+QTEST_MAIN(TestFolderMan)
+#include "testfolderman.moc"
@@ -0,0 +1,18 @@
+#ifndef MIRALL_TEST_FOLDERMAN_H
+#define MIRALL_TEST_FOLDERMAN_H
+
+#include <QtTest/QtTest>
+
+class TestFolderMan : public QObject
+{
+    Q_OBJECT
+public:
+
+private slots:
+    void testServerLimits();
+
+private:
+};
+
+
+#endif
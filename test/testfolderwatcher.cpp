@@ -1,3 +1,4 @@
+#include <cstdio>
 #include <cstdlib>
 #include <cerrno>
 #include <cstring>
@@ -27,10 +28,18 @@ void TestFolderWatcher::testFilesAdded()
     // lower the event interval
     watcher.setEventInterval(1);
 
+    QSignalSpy spy(&watcher, SIGNAL(folderChanged(const QStringList &)));
+
+    // the watches are set up from the event loop, followed
+    // by the initial sync notification.
+    while (!watcher.isReady() || spy.count() == 0)
+        QTest::qWait(100);
+    QVERIFY(watcher.setupTime() >= 0);
+    spy.clear();
+
     qDebug() << "Monitored: " << watcher.folders();
 
     QDir subdir = QDir(tmp.path());
-    QSignalSpy spy(&watcher, SIGNAL(folderChanged(const QStringList &)));
 
     QVERIFY(subdir.mkpath(tmp.path() + "/sub1/sub2"));
     QVERIFY(subdir.mkpath(tmp.path() + "/sub2"));
@@ -63,5 +72,294 @@ void TestFolderWatcher::testFilesAdded()
     Mirall::INotify::cleanup();
 }
 
+void TestFolderWatcher::testNewFolderContents()
+{
+    Mirall::INotify::initialize();
+    Mirall::TemporaryDir tmp;
+    Mirall::FolderWatcher watcher(tmp.path());
+    watcher.setEventInterval(1);
+
+    QSignalSpy spy(&watcher, SIGNAL(folderChanged(const QStringList &)));
+    while (!watcher.isReady() || spy.count() == 0)
+        QTest::qWait(100);
+    spy.clear();
+
+    // the file is created before the event loop had
+    // a chance to add a watch for the new folders.
+    QVERIFY(QDir(tmp.path()).mkpath(tmp.path() + "/new1/new2"));
+    QFile file(tmp.path() + "/new1/new2/early.txt");
+    file.open(QIODevice::WriteOnly);
+    file.write("hello", 5);
+    file.close();
+
+    while (spy.count() == 0)
+        QTest::qWait(100);
+
+    QStringList paths = spy.takeFirst().at(0).toStringList();
+    qDebug() << paths;
+    QVERIFY(paths.contains(tmp.path() + "/new1/new2/early.txt"));
+    QVERIFY(watcher.folders().contains(tmp.path() + "/new1/new2"));
+
+    Mirall::INotify::cleanup();
+}
+
+void TestFolderWatcher::testQueueOverflow()
+{
+    Mirall::INotify::initialize();
+    Mirall::TemporaryDir tmp;
+    QVERIFY(QDir(tmp.path()).mkpath(tmp.path() + "/burst"));
+
+    Mirall::FolderWatcher watcher(tmp.path());
+    watcher.setEventInterval(1);
+    // a tiny queue, the burst below can not fit
+    watcher.setEventQueueCapacity(4);
+
+    QSignalSpy spy(&watcher, SIGNAL(folderChanged(const QStringList &)));
+    while (!watcher.isReady() || spy.count() == 0)
+        QTest::qWait(100);
+    spy.clear();
+    QCOMPARE(watcher.overflowCount(), 0);
+
+    // no event loop runs while the files are written
+    for (int i = 0; i < 64; ++i) {
+        QFile file(tmp.path() + QString("/burst/file%1").arg(i));
+        file.open(QIODevice::WriteOnly);
+        file.close();
+    }
+
+    while (spy.count() == 0 || watcher.lastRecoveryTime() < 0)
+        QTest::qWait(100);
+
+    QVERIFY(watcher.overflowCount() > 0);
+    QStringList paths;
+    while (!spy.isEmpty())
+        paths << spy.takeFirst().at(0).toStringList();
+    qDebug() << paths;
+    // the folder whose events got lost is handed over as changed
+    QVERIFY(paths.contains(tmp.path() + "/burst"));
+
+    Mirall::INotify::cleanup();
+}
+
+void TestFolderWatcher::testFolderMoved()
+{
+    Mirall::INotify::initialize();
+    Mirall::TemporaryDir tmp;
+    QVERIFY(QDir(tmp.path()).mkpath(tmp.path() + "/old/sub"));
+
+    Mirall::FolderWatcher watcher(tmp.path());
+    watcher.setEventInterval(1);
+
+    QSignalSpy spy(&watcher, SIGNAL(folderChanged(const QStringList &)));
+    QSignalSpy movedSpy(&watcher, SIGNAL(pathsMoved(const PathMoveList &)));
+    while (!watcher.isReady() || spy.count() == 0)
+        QTest::qWait(100);
+    spy.clear();
+    movedSpy.clear();
+
+    QVERIFY(QDir(tmp.path()).rename("old", "new"));
+
+    while (spy.count() == 0)
+        QTest::qWait(100);
+
+    QStringList paths = spy.takeFirst().at(0).toStringList();
+    qDebug() << paths;
+    QVERIFY(paths.contains(tmp.path() + "/old"));
+    QVERIFY(paths.contains(tmp.path() + "/new"));
+    // both halves were paired by their cookie
+    QCOMPARE(movedSpy.count(), 1);
+    const Mirall::PathMoveList moves = qvariant_cast<Mirall::PathMoveList>(movedSpy.at(0).at(0));
+    QCOMPARE(moves.size(), 1);
+    QCOMPARE(moves.at(0).from, tmp.path() + "/old");
+    QCOMPARE(moves.at(0).to, tmp.path() + "/new");
+    QVERIFY(moves.at(0).isDir);
+    // the watches moved along with the folder
+    QVERIFY(watcher.folders().contains(tmp.path() + "/new/sub"));
+    QVERIFY(!watcher.folders().contains(tmp.path() + "/old/sub"));
+
+    Mirall::INotify::cleanup();
+}
+
+void TestFolderWatcher::testHiddenFolderCreated()
+{
+    Mirall::INotify::initialize();
+    Mirall::TemporaryDir tmp;
+
+    Mirall::FolderWatcher watcher(tmp.path());
+    watcher.setEventInterval(1);
+
+    QSignalSpy spy(&watcher, SIGNAL(folderChanged(const QStringList &)));
+    while (!watcher.isReady() || spy.count() == 0)
+        QTest::qWait(100);
+    spy.clear();
+
+    QVERIFY(QDir(tmp.path()).mkpath(".git/objects"));
+    QVERIFY(QDir(tmp.path()).mkdir("visible"));
+    while (spy.count() == 0)
+        QTest::qWait(100);
+
+    // a hidden folder is not watched, like at startup
+    QVERIFY(watcher.folders().contains(tmp.path() + "/visible"));
+    QVERIFY(!watcher.folders().contains(tmp.path() + "/.git"));
+    QVERIFY(!watcher.folders().contains(tmp.path() + "/.git/objects"));
+
+    // and nothing in it is reported
+    spy.clear();
+    QFile file(tmp.path() + "/.git/objects/pack");
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.close();
+    QTest::qWait(500);
+    QCOMPARE(spy.count(), 0);
+
+    Mirall::INotify::cleanup();
+}
+
+void TestFolderWatcher::testMaxLatency()
+{
+    Mirall::INotify::initialize();
+    Mirall::TemporaryDir tmp;
+
+    Mirall::FolderWatcher watcher(tmp.path());
+    watcher.setEventInterval(1000);
+    watcher.setMaxLatency(3000);
+
+    QSignalSpy spy(&watcher, SIGNAL(folderChanged(const QStringList &)));
+    while (!watcher.isReady() || spy.count() == 0)
+        QTest::qWait(100);
+    spy.clear();
+
+    // a change every 300 msec never lets the events settle
+    QTime elapsed;
+    elapsed.start();
+    for (int i = 0; spy.count() == 0 && elapsed.elapsed() < 8000; ++i) {
+        QFile file(tmp.path() + QString("/stream%1").arg(i));
+        file.open(QIODevice::WriteOnly);
+        file.close();
+        QTest::qWait(300);
+    }
+
+    QCOMPARE(spy.count(), 1);
+    qDebug() << "latency" << watcher.lastLatency() << "window" << watcher.settleWindow();
+    QVERIFY(watcher.lastLatency() >= 0);
+    QVERIFY(watcher.lastLatency() <= 3000 + 500);
+
+    Mirall::INotify::cleanup();
+}
+
+void TestFolderWatcher::testCoalescing()
+{
+    Mirall::INotify::initialize();
+    Mirall::TemporaryDir tmp;
+    QFile original(tmp.path() + "/doc.txt");
+    QVERIFY(original.open(QIODevice::WriteOnly));
+    original.close();
+
+    Mirall::FolderWatcher watcher(tmp.path());
+    watcher.setEventInterval(1000);
+
+    QSignalSpy spy(&watcher, SIGNAL(folderChanged(const QStringList &)));
+    while (!watcher.isReady() || spy.count() == 0)
+        QTest::qWait(100);
+    spy.clear();
+
+    // a file which only lives for a moment
+    QFile transient(tmp.path() + "/transient");
+    QVERIFY(transient.open(QIODevice::WriteOnly));
+    transient.write("x");
+    transient.close();
+    QVERIFY(transient.remove());
+
+    // an editor saving doc.txt through a temporary file
+    QFile temp(tmp.path() + "/doc.txt.new");
+    QVERIFY(temp.open(QIODevice::WriteOnly));
+    temp.write("new content");
+    temp.close();
+    QVERIFY(::rename(QFile::encodeName(temp.fileName()).constData(),
+                     QFile::encodeName(original.fileName()).constData()) == 0);
+
+    while (spy.count() == 0)
+        QTest::qWait(100);
+
+    QStringList paths = spy.takeFirst().at(0).toStringList();
+    qDebug() << paths;
+    QCOMPARE(paths, QStringList() << tmp.path() + "/doc.txt");
+
+    Mirall::INotify::cleanup();
+}
+
+void TestFolderWatcher::testOverlappingFolders()
+{
+    Mirall::INotify::initialize();
+    // nothing is left from the tests before
+    QCOMPARE(Mirall::INotify::kernelWatchCount(), 0);
+    Mirall::TemporaryDir tmp;
+    QVERIFY(QDir(tmp.path()).mkpath(tmp.path() + "/inner/deep"));
+
+    Mirall::FolderWatcher outer(tmp.path());
+    Mirall::FolderWatcher inner(tmp.path() + "/inner");
+    outer.setEventInterval(1);
+    inner.setEventInterval(1);
+
+    QSignalSpy outerSpy(&outer, SIGNAL(folderChanged(const QStringList &)));
+    QSignalSpy innerSpy(&inner, SIGNAL(folderChanged(const QStringList &)));
+    while (!outer.isReady() || !inner.isReady() || outerSpy.count() == 0 || innerSpy.count() == 0)
+        QTest::qWait(100);
+    outerSpy.clear();
+    innerSpy.clear();
+
+    // the kernel has one watch per folder, shared by both
+    QCOMPARE(Mirall::INotify::kernelWatchCount(), 3);
+
+    QFile file(tmp.path() + "/inner/deep/file");
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.close();
+
+    while (outerSpy.count() == 0 || innerSpy.count() == 0)
+        QTest::qWait(100);
+    QVERIFY(outerSpy.takeFirst().at(0).toStringList().contains(file.fileName()));
+    QVERIFY(innerSpy.takeFirst().at(0).toStringList().contains(file.fileName()));
+
+    Mirall::INotify::cleanup();
+}
+
+void TestFolderWatcher::testEventsWhileDisabled()
+{
+    Mirall::INotify::initialize();
+    Mirall::TemporaryDir tmp;
+    Mirall::FolderWatcher watcher(tmp.path());
+    watcher.setEventInterval(1);
+
+    QSignalSpy spy(&watcher, SIGNAL(folderChanged(const QStringList &)));
+    while (!watcher.isReady() || spy.count() == 0)
+        QTest::qWait(100);
+    spy.clear();
+
+    // like during a sync
+    watcher.setEventsEnabled(false);
+    QVERIFY(QDir(tmp.path()).mkpath(tmp.path() + "/new"));
+    QTest::qWait(200);
+    QFile file(tmp.path() + "/new/file");
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.close();
+    QTest::qWait(1500);
+
+    QCOMPARE(spy.count(), 0);
+    // the new folder is watched all the same
+    QVERIFY(watcher.folders().contains(tmp.path() + "/new"));
+    QStringList pending = watcher.pendingPaths();
+    pending.sort();
+    QCOMPARE(pending, QStringList() << tmp.path() + "/new" << file.fileName());
+
+    watcher.setEventsEnabled(true);
+    while (spy.count() == 0)
+        QTest::qWait(100);
+    QStringList paths = spy.takeFirst().at(0).toStringList();
+    paths.sort();
+    QCOMPARE(paths, pending);
+    QVERIFY(watcher.pendingPaths().isEmpty());
+
+    Mirall::INotify::cleanup();
+}
+
 QTEST_MAIN(TestFolderWatcher)
 #include "testfolderwatcher.moc"
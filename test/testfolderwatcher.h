@@ -15,6 +15,14 @@ private slots:
     void cleanupTestCase();
 
     void testFilesAdded();
+    void testNewFolderContents();
+    void testQueueOverflow();
+    void testFolderMoved();
+    void testHiddenFolderCreated();
+    void testMaxLatency();
+    void testCoalescing();
+    void testOverlappingFolders();
+    void testEventsWhileDisabled();
 
 private:
     Mirall::FolderWatcher *_watcher;
@@ -0,0 +1,163 @@
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QThread>
+
+#include <sys/inotify.h>
+
+#include "mirall/temporarydir.h"
+#include "testinotify.h"
+
+using Mirall::INotify;
+
+namespace {
+
+// creates and deletes files as fast as it can
+class FloodThread : public QThread
+{
+public:
+    FloodThread(const QString &dir) : _dir(dir), _stop(0), _files(0) {}
+
+    void stop() { _stop = 1; }
+    int files() const { return _files; }
+
+protected:
+    void run()
+    {
+        for (int i = 0; !_stop; ++i) {
+            QFile file(_dir + QString("/flood%1").arg(i % 64));
+            file.open(QIODevice::WriteOnly);
+            file.close();
+            file.remove();
+            _files++;
+        }
+    }
+
+private:
+    QString _dir;
+    QAtomicInt _stop;
+    int _files;
+};
+
+}
+
+void TestINotify::initTestCase()
+{
+    INotify::initialize();
+}
+
+void TestINotify::cleanupTestCase()
+{
+    INotify::cleanup();
+}
+
+void TestINotify::slotEvents(const INotifyEventList &events)
+{
+    _events += events.size();
+}
+
+void TestINotify::testWatchChurn()
+{
+    Mirall::TemporaryDir tmp;
+    QDir dir(tmp.path());
+    QVERIFY(dir.mkpath("flood"));
+    for (int i = 0; i < 200; ++i)
+        QVERIFY(dir.mkpath(QString("churn/dir%1").arg(i)));
+
+    INotify steady(IN_CREATE | IN_DELETE | IN_CLOSE_WRITE);
+    QVERIFY(steady.addPath(tmp.path() + "/flood"));
+    connect(&steady, SIGNAL(notifyEvents(const INotifyEventList &)),
+            SLOT(slotEvents(const INotifyEventList &)));
+
+    FloodThread flood(tmp.path() + "/flood");
+    flood.start();
+
+    // watches come and go while the events flood in, some of
+    // them on the flooded folder itself
+    QTime elapsed;
+    elapsed.start();
+    int rounds = 0;
+    while (elapsed.elapsed() < 3000) {
+        INotify *churn = new INotify(IN_CREATE | IN_DELETE | IN_CLOSE_WRITE);
+        churn->addPath(tmp.path() + "/flood");
+        for (int i = 0; i < 200; ++i)
+            churn->addPath(tmp.path() + QString("/churn/dir%1").arg(i));
+        QCoreApplication::processEvents();
+        for (int i = 0; i < 200; i += 2)
+            churn->removePath(tmp.path() + QString("/churn/dir%1").arg(i));
+        QCoreApplication::processEvents();
+        delete churn;
+        rounds++;
+    }
+
+    flood.stop();
+    flood.wait();
+    QTest::qWait(200);
+
+    qDebug() << rounds << "rounds," << flood.files() << "files," << _events << "events,"
+             << steady.eventCount() << "delivered in" << steady.batchCount() << "batches";
+    QVERIFY(rounds > 0);
+    // the steady watcher kept receiving events all along
+    QVERIFY(_events > 0);
+    QCOMPARE(steady.directories(), QStringList() << tmp.path() + "/flood");
+    QCOMPARE(INotify::kernelWatchCount(), 1);
+}
+
+void TestINotify::slotWakeUp()
+{
+    _wakeUps++;
+}
+
+void TestINotify::testStartupShutdown()
+{
+    Mirall::TemporaryDir tmp;
+
+    // the thread leaves its wait right away, even with a
+    // watch in place and no events coming
+    for (int i = 0; i < 5; ++i) {
+        INotify::cleanup();
+        qDebug() << "shutdown took" << INotify::shutdownTime() << "msec";
+        QVERIFY(INotify::shutdownTime() >= 0);
+        QVERIFY(INotify::shutdownTime() < 500);
+
+        INotify::initialize();
+        qDebug() << "startup took" << INotify::startupTime() << "msec";
+        QVERIFY(INotify::startupTime() >= 0);
+        QVERIFY(INotify::startupTime() < 500);
+
+        INotify idle(IN_CREATE);
+        QVERIFY(idle.addPath(tmp.path()));
+        idle.wakeUpIn(60000);
+    }
+}
+
+void TestINotify::testWakeUp()
+{
+    INotify notifier(IN_CREATE);
+    connect(&notifier, SIGNAL(wakeUp()), SLOT(slotWakeUp()));
+
+    _wakeUps = 0;
+    QTime elapsed;
+    elapsed.start();
+    notifier.wakeUpIn(100);
+    QVERIFY(notifier.wakeUpPending());
+    QTest::qWait(50);
+    QCOMPARE(_wakeUps, 0);
+    // moving it to a later time replaces the first one
+    notifier.wakeUpIn(200);
+    for (int i = 0; i < 50 && _wakeUps == 0; ++i)
+        QTest::qWait(20);
+    QCOMPARE(_wakeUps, 1);
+    QVERIFY(elapsed.elapsed() >= 250);
+    QVERIFY(!notifier.wakeUpPending());
+
+    // a cancelled one never comes
+    notifier.wakeUpIn(50);
+    notifier.cancelWakeUp();
+    QTest::qWait(200);
+    QCOMPARE(_wakeUps, 1);
+}
+
+QTEST_MAIN(TestINotify)
+#include "testinotify.moc"
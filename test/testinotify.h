@@ -0,0 +1,34 @@
+#ifndef MIRALL_TEST_INOTIFY_H
+#define MIRALL_TEST_INOTIFY_H
+
+#include <QtTest/QtTest>
+
+#include "mirall/inotify.h"
+
+using Mirall::INotifyEventList;
+
+class TestINotify : public QObject
+{
+    Q_OBJECT
+public:
+    TestINotify() : _events(0), _wakeUps(0) {}
+
+public slots:
+    void slotEvents(const INotifyEventList &events);
+    void slotWakeUp();
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void testWatchChurn();
+    void testStartupShutdown();
+    void testWakeUp();
+
+private:
+    int _events;
+    int _wakeUps;
+};
+
+
+#endif
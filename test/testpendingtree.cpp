@@ -0,0 +1,95 @@
+
+#include <QDebug>
+
+#include "mirall/pendingtree.h"
+#include "testpendingtree.h"
+
+using Mirall::PendingTree;
+
+void TestPendingTree::testMerge()
+{
+    PendingTree tree("/root");
+    QVERIFY(tree.isEmpty());
+
+    tree.note("/root/a/new", PendingTree::Created);
+    tree.note("/root/a/gone", PendingTree::Deleted);
+    tree.note("/root/a/old", PendingTree::Modified);
+    tree.note("/root/b/temp", PendingTree::Created);
+    // deleted and created again
+    tree.note("/root/a/gone", PendingTree::Created);
+    // modified and deleted
+    tree.note("/root/a/old", PendingTree::Deleted);
+    // created and gone again, b goes with it
+    tree.note("/root/b/temp", PendingTree::Deleted);
+
+    QCOMPARE(tree.change("/root/a/new"), PendingTree::Created);
+    QCOMPARE(tree.change("/root/a/gone"), PendingTree::Modified);
+    QCOMPARE(tree.change("/root/a/old"), PendingTree::Deleted);
+    QCOMPARE(tree.change("/root/b/temp"), PendingTree::NoChange);
+    QCOMPARE(tree.change("/root/a"), PendingTree::NoChange);
+
+    QStringList paths = tree.paths();
+    paths.sort();
+    QCOMPARE(paths, QStringList() << "/root/a/gone" << "/root/a/new" << "/root/a/old");
+    // root, a and its three children
+    QCOMPARE(tree.nodeCount(), 5);
+
+    tree.note("/elsewhere/file", PendingTree::Created);
+    QCOMPARE(tree.paths().size(), 3);
+
+    tree.clear();
+    QVERIFY(tree.isEmpty());
+    QCOMPARE(tree.nodeCount(), 1);
+    QCOMPARE(tree.paths(), QStringList());
+}
+
+void TestPendingTree::testFanOut()
+{
+    PendingTree tree("/root");
+    tree.setMaxFanOut(10);
+
+    tree.note("/root/keep", PendingTree::Modified);
+    for (int i = 0; i < 100; ++i)
+        tree.note(QString("/root/extract/dir/file%1").arg(i), PendingTree::Created);
+
+    QCOMPARE(tree.collapsedCount(), 1);
+    QVERIFY(tree.isCovered("/root/extract/dir/file99"));
+    QVERIFY(tree.isCovered("/root/extract/dir"));
+    QVERIFY(!tree.isCovered("/root/extract"));
+    QVERIFY(!tree.isCovered("/root/keep"));
+
+    QStringList paths = tree.paths();
+    paths.sort();
+    QCOMPARE(paths, QStringList() << "/root/extract/dir" << "/root/keep");
+    // root, keep, extract and the collapsed dir
+    QCOMPARE(tree.nodeCount(), 4);
+}
+
+void TestPendingTree::testNodeLimit()
+{
+    PendingTree tree("/root");
+    tree.setMaxFanOut(1000);
+    tree.setMaxNodes(200);
+
+    // a deep tree with few children each never hits the fan out
+    for (int i = 0; i < 50; ++i) {
+        for (int k = 0; k < 5; ++k) {
+            tree.note(QString("/root/a/d%1/s%2/file").arg(i).arg(k), PendingTree::Created);
+            QVERIFY(tree.nodeCount() <= 200);
+        }
+    }
+    tree.note("/root/b", PendingTree::Modified);
+
+    QVERIFY(tree.nodeCount() <= 200);
+    QVERIFY(tree.collapsedCount() > 0);
+    // everything changed is still reported, some as a whole
+    for (int i = 0; i < 50; ++i) {
+        const QString file = QString("/root/a/d%1/s4/file").arg(i);
+        QVERIFY(tree.change(file) == PendingTree::Created || tree.isCovered(file));
+    }
+    QCOMPARE(tree.change("/root/b"), PendingTree::Modified);
+    qDebug() << tree.paths().size() << "paths in" << tree.nodeCount() << "nodes";
+}
+
+QTEST_MAIN(TestPendingTree)
+#include "testpendingtree.moc"
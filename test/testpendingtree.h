@@ -0,0 +1,20 @@
+#ifndef MIRALL_TEST_PENDINGTREE_H
+#define MIRALL_TEST_PENDINGTREE_H
+
+#include <QtTest/QtTest>
+
+class TestPendingTree : public QObject
+{
+    Q_OBJECT
+public:
+
+private slots:
+    void testMerge();
+    void testFanOut();
+    void testNodeLimit();
+
+private:
+};
+
+
+#endif
@@ -0,0 +1,121 @@
+
+#include <QAtomicInt>
+#include <QDebug>
+#include <QThread>
+
+#include "mirall/syncexecutor.h"
+#include "testsyncexecutor.h"
+
+using Mirall::SyncExecutor;
+using Mirall::SyncJob;
+
+namespace {
+
+// sleeps a while and counts how many jobs ran at the same time
+class SleepJob : public SyncJob
+{
+public:
+    SleepJob(QAtomicInt *active, QAtomicInt *peak, int msecs)
+        : runs(0), _active(active), _peak(peak), _msecs(msecs) {}
+
+    void execute()
+    {
+        const int now = _active->fetchAndAddOrdered(1) + 1;
+        int peak = _peak->fetchAndAddOrdered(0);
+        while (now > peak && !_peak->testAndSetOrdered(peak, now))
+            peak = _peak->fetchAndAddOrdered(0);
+        Sleeper::msleep(_msecs);
+        _active->fetchAndAddOrdered(-1);
+        runs++;
+    }
+
+    int runs;
+
+private:
+    class Sleeper : public QThread
+    {
+    public:
+        using QThread::msleep;
+    };
+
+    QAtomicInt *_active;
+    QAtomicInt *_peak;
+    int _msecs;
+};
+
+}
+
+void TestSyncExecutor::testWorkerLimit()
+{
+    QAtomicInt active(0);
+    QAtomicInt peak(0);
+    SyncExecutor executor(2);
+
+    QList<SleepJob*> jobs;
+    for (int i = 0; i < 6; ++i) {
+        jobs.append(new SleepJob(&active, &peak, 50));
+        QVERIFY(executor.enqueue(jobs.last()));
+    }
+    // a queued job is not queued twice
+    QVERIFY(!executor.enqueue(jobs.last()));
+
+    foreach (SleepJob *job, jobs)
+        executor.wait(job);
+
+    QCOMPARE(int(peak), 2);
+    QCOMPARE(executor.threadCount(), 2);
+    QCOMPARE(executor.queuedJobs(), 0);
+    QCOMPARE(executor.runningJobs(), 0);
+    foreach (SleepJob *job, jobs) {
+        QCOMPARE(job->runs, 1);
+        QVERIFY(job->runTime() >= 40);
+        QVERIFY(job->queueTime() >= 0);
+    }
+    // the last ones waited for the first ones
+    QVERIFY(jobs.last()->queueTime() >= 80);
+    qDeleteAll(jobs);
+}
+
+void TestSyncExecutor::testRequeue()
+{
+    QAtomicInt active(0);
+    QAtomicInt peak(0);
+    SyncExecutor executor(4);
+    SleepJob job(&active, &peak, 1);
+
+    for (int i = 0; i < 20; ++i) {
+        QVERIFY(executor.enqueue(&job));
+        executor.wait(&job);
+        QVERIFY(!executor.isBusy(&job));
+    }
+    QCOMPARE(job.runs, 20);
+    // the jobs ran one after the other, on the same thread
+    QCOMPARE(executor.threadCount(), 1);
+}
+
+void TestSyncExecutor::testRemove()
+{
+    QAtomicInt active(0);
+    QAtomicInt peak(0);
+    SyncExecutor executor(1);
+    SleepJob slow(&active, &peak, 100);
+    SleepJob queued(&active, &peak, 1);
+
+    QVERIFY(executor.enqueue(&slow));
+    while (executor.runningJobs() == 0)
+        QTest::qWait(1);
+    QVERIFY(executor.enqueue(&queued));
+    QVERIFY(executor.isBusy(&queued));
+    QVERIFY(executor.remove(&queued));
+    QVERIFY(!executor.isBusy(&queued));
+    // the running one can not be taken back
+    QVERIFY(!executor.remove(&slow));
+
+    executor.wait(&slow);
+    QCOMPARE(slow.runs, 1);
+    QCOMPARE(queued.runs, 0);
+    QCOMPARE(queued.queueTime(), -1);
+}
+
+QTEST_MAIN(TestSyncExecutor)
+#include "testsyncexecutor.moc"
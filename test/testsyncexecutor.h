@@ -0,0 +1,20 @@
+#ifndef MIRALL_TEST_SYNCEXECUTOR_H
+#define MIRALL_TEST_SYNCEXECUTOR_H
+
+#include <QtTest/QtTest>
+
+class TestSyncExecutor : public QObject
+{
+    Q_OBJECT
+public:
+
+private slots:
+    void testWorkerLimit();
+    void testRequeue();
+    void testRemove();
+
+private:
+};
+
+
+#endif
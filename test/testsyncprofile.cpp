@@ -0,0 +1,50 @@
+
+#include <QDebug>
+
+#include "mirall/syncprofile.h"
+#include "testsyncprofile.h"
+
+using Mirall::SyncProfile;
+
+void TestSyncProfile::testPhases()
+{
+    SyncProfile profile;
+    QVERIFY(profile.isEmpty());
+    QCOMPARE(profile.time(SyncProfile::UpdatePhase), -1);
+
+    // a reused session skips create and init
+    profile.setTime(SyncProfile::UpdatePhase, 120);
+    profile.setFiles(SyncProfile::UpdatePhase, 5000);
+    profile.setTime(SyncProfile::WalkPhase, 30);
+    profile.setTime(SyncProfile::PropagatePhase, 0);
+    profile.addError(SyncProfile::PropagatePhase);
+
+    QVERIFY(!profile.isEmpty());
+    QCOMPARE(profile.totalTime(), 150);
+    QCOMPARE(profile.errorCount(), 1);
+    QCOMPARE(profile.files(SyncProfile::UpdatePhase), ulong(5000));
+    QCOMPARE(profile.toString(),
+             QString("update 120ms 5000 files, walk 30ms, propagate 0ms 1 errors"));
+}
+
+void TestSyncProfile::testMedian()
+{
+    QList<SyncProfile> history;
+    QCOMPARE(SyncProfile::medianTime(history, SyncProfile::InitPhase), -1);
+
+    const int updates[] = { 300, 100, 200, 5000 };
+    for (int i = 0; i < 4; ++i) {
+        SyncProfile profile;
+        profile.setTime(SyncProfile::UpdatePhase, updates[i]);
+        // only the first run opened the session
+        if (i == 0)
+            profile.setTime(SyncProfile::InitPhase, 900);
+        history.append(profile);
+    }
+    QCOMPARE(SyncProfile::medianTime(history, SyncProfile::UpdatePhase), 300);
+    QCOMPARE(SyncProfile::medianTime(history, SyncProfile::InitPhase), 900);
+    QCOMPARE(SyncProfile::medianTime(history, SyncProfile::ReconcilePhase), -1);
+}
+
+QTEST_MAIN(TestSyncProfile)
+#include "testsyncprofile.moc"
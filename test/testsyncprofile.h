@@ -0,0 +1,19 @@
+#ifndef MIRALL_TEST_SYNCPROFILE_H
+#define MIRALL_TEST_SYNCPROFILE_H
+
+#include <QtTest/QtTest>
+
+class TestSyncProfile : public QObject
+{
+    Q_OBJECT
+public:
+
+private slots:
+    void testPhases();
+    void testMedian();
+
+private:
+};
+
+
+#endif
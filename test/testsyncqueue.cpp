@@ -0,0 +1,84 @@
+
+#include <QDebug>
+
+#include "mirall/syncqueue.h"
+#include "testsyncqueue.h"
+
+using Mirall::Folder;
+using Mirall::SyncQueue;
+
+void TestSyncQueue::testOrder()
+{
+    SyncQueue queue;
+    queue.enqueue("giant", Folder::PollTrigger, SyncQueue::FullSyncCost, 1000);
+    queue.enqueue("fresh", Folder::StartupTrigger, SyncQueue::FullSyncCost, 2000);
+    queue.enqueue("many", Folder::LocalChangeTrigger, 500, 3000);
+    queue.enqueue("old", Folder::LocalChangeTrigger, 3, 4000);
+    queue.enqueue("doc", Folder::LocalChangeTrigger, 3, 5000);
+
+    QCOMPARE(queue.size(), 5);
+    QCOMPARE(queue.ordered(6000), QStringList() << "old" << "doc" << "many" << "fresh" << "giant");
+
+    // a local change of the polled folder makes it urgent,
+    // it keeps the time it was queued at
+    queue.enqueue("giant", Folder::LocalChangeTrigger, 2, 6000);
+    QCOMPARE(queue.size(), 5);
+    QCOMPARE(queue.queuedAt("giant"), qint64(1000));
+    QCOMPARE(queue.ordered(6000).first(), QString("giant"));
+    // a later poll does not make it less urgent again
+    queue.enqueue("giant", Folder::PollTrigger, SyncQueue::FullSyncCost, 7000);
+    QCOMPARE(queue.ordered(7000).indexOf("giant"), 3);
+
+    Folder::SyncTrigger trigger;
+    QCOMPARE(queue.take("giant", &trigger), qint64(1000));
+    QCOMPARE(trigger, Folder::LocalChangeTrigger);
+    QVERIFY(!queue.contains("giant"));
+    // a preempted sync comes back with the time it was first queued
+    queue.enqueue("doc", Folder::LocalChangeTrigger, 3, 500);
+    QCOMPARE(queue.queuedAt("doc"), qint64(500));
+    queue.remove("doc");
+    QCOMPARE(queue.ordered(7000), QStringList() << "old" << "many" << "fresh");
+}
+
+void TestSyncQueue::testAging()
+{
+    SyncQueue queue;
+    queue.setAgingStep(1000);
+    queue.enqueue("poll", Folder::PollTrigger, SyncQueue::FullSyncCost, 0);
+    queue.enqueue("edit", Folder::LocalChangeTrigger, 1, 500);
+
+    QCOMPARE(queue.ordered(600), QStringList() << "edit" << "poll");
+    // one step later the full scan ranks with the initial syncs
+    QCOMPARE(queue.ordered(1500), QStringList() << "edit" << "poll");
+
+    // two steps later it ranks with the local changes, the
+    // cheaper ones still go first
+    queue.enqueue("edit2", Folder::LocalChangeTrigger, 1, 2000);
+    QCOMPARE(queue.ordered(2000), QStringList() << "edit" << "edit2" << "poll");
+    queue.take("edit", 0);
+    queue.take("edit2", 0);
+
+    // but not for long, fresh edits do not get ahead anymore
+    queue.enqueue("edit3", Folder::LocalChangeTrigger, 1, 3000);
+    QCOMPARE(queue.ordered(3000), QStringList() << "poll" << "edit3");
+}
+
+void TestSyncQueue::testWaitPercentiles()
+{
+    SyncQueue queue;
+    QCOMPARE(queue.waitPercentile(Folder::LocalChangeTrigger, 50), -1);
+
+    for (int i = 100; i >= 1; --i)
+        queue.recordWait(Folder::LocalChangeTrigger, i * 10);
+    queue.recordWait(Folder::PollTrigger, 60000);
+
+    QCOMPARE(queue.waitPercentile(Folder::LocalChangeTrigger, 50), 500);
+    QCOMPARE(queue.waitPercentile(Folder::LocalChangeTrigger, 90), 900);
+    QCOMPARE(queue.waitPercentile(Folder::LocalChangeTrigger, 100), 1000);
+    QCOMPARE(queue.waitPercentile(Folder::LocalChangeTrigger, 0), 10);
+    QCOMPARE(queue.waitPercentile(Folder::PollTrigger, 99), 60000);
+    QCOMPARE(queue.waitPercentile(Folder::StartupTrigger, 50), -1);
+}
+
+QTEST_MAIN(TestSyncQueue)
+#include "testsyncqueue.moc"
@@ -0,0 +1,20 @@
+#ifndef MIRALL_TEST_SYNCQUEUE_H
+#define MIRALL_TEST_SYNCQUEUE_H
+
+#include <QtTest/QtTest>
+
+class TestSyncQueue : public QObject
+{
+    Q_OBJECT
+public:
+
+private slots:
+    void testOrder();
+    void testAging();
+    void testWaitPercentiles();
+
+private:
+};
+
+
+#endif
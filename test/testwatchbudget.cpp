@@ -0,0 +1,126 @@
+#include <utime.h>
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+
+#include "mirall/temporarydir.h"
+#include "mirall/watchbudget.h"
+#include "testwatchbudget.h"
+
+using Mirall::WatchBudget;
+
+// moves the mtime of dir by secs from now
+static void setMTime(const QString &dir, int secs)
+{
+    struct utimbuf times;
+    times.actime = times.modtime = QDateTime::currentDateTime().toTime_t() + secs;
+    QCOMPARE(utime(QFile::encodeName(dir).constData(), &times), 0);
+}
+
+// runs a whole pass, whatever the slices
+static void checkAll(WatchBudget *budget, QStringList *changed, QStringList *gone)
+{
+    while (!budget->check(changed, gone, 1000))
+        ;
+}
+
+void TestWatchBudget::testCheck()
+{
+    Mirall::TemporaryDir tmp;
+    const QString dir = tmp.path() + "/polled";
+    QVERIFY(QDir(tmp.path()).mkdir("polled"));
+
+    WatchBudget budget;
+    QVERIFY(!budget.demote(tmp.path() + "/missing"));
+    QVERIFY(budget.demote(dir));
+    QVERIFY(budget.contains(dir));
+    QCOMPARE(budget.count(), 1);
+
+    // a different mtime is a change, the same old one is not
+    QStringList changed;
+    QStringList gone;
+    setMTime(dir, -60);
+    checkAll(&budget, &changed, &gone);
+    QCOMPARE(changed, QStringList() << dir);
+    QVERIFY(gone.isEmpty());
+    changed.clear();
+    checkAll(&budget, &changed, &gone);
+    QVERIFY(changed.isEmpty());
+
+    // an mtime not older than the last check is reported
+    // again, a later change in that second could be missed.
+    setMTime(dir, 60);
+    checkAll(&budget, &changed, &gone);
+    QCOMPARE(changed, QStringList() << dir);
+    changed.clear();
+    checkAll(&budget, &changed, &gone);
+    QCOMPARE(changed, QStringList() << dir);
+
+    // a new entry touches the folder
+    setMTime(dir, -60);
+    checkAll(&budget, &changed, &gone);
+    changed.clear();
+    QVERIFY(QDir(dir).mkdir("sub"));
+    checkAll(&budget, &changed, &gone);
+    QCOMPARE(changed, QStringList() << dir);
+
+    // a folder which is gone is dropped
+    changed.clear();
+    QVERIFY(QDir(dir).rmdir("sub"));
+    QVERIFY(QDir(tmp.path()).rmdir("polled"));
+    checkAll(&budget, &changed, &gone);
+    QVERIFY(changed.isEmpty());
+    QCOMPARE(gone, QStringList() << dir);
+    QCOMPARE(budget.count(), 0);
+}
+
+void TestWatchBudget::testRenameAndRemove()
+{
+    Mirall::TemporaryDir tmp;
+    QVERIFY(QDir(tmp.path()).mkpath("a/b"));
+    QVERIFY(QDir(tmp.path()).mkpath("ab"));
+
+    WatchBudget budget;
+    QVERIFY(budget.demote(tmp.path() + "/a"));
+    QVERIFY(budget.demote(tmp.path() + "/a/b"));
+    QVERIFY(budget.demote(tmp.path() + "/ab"));
+
+    // "ab" is not below "a"
+    budget.rename(tmp.path() + "/a", tmp.path() + "/c");
+    QVERIFY(!budget.contains(tmp.path() + "/a"));
+    QVERIFY(budget.contains(tmp.path() + "/c"));
+    QVERIFY(budget.contains(tmp.path() + "/c/b"));
+    QVERIFY(budget.contains(tmp.path() + "/ab"));
+
+    QCOMPARE(budget.removeTree(tmp.path() + "/c"), 2);
+    QVERIFY(budget.remove(tmp.path() + "/ab"));
+    QVERIFY(!budget.remove(tmp.path() + "/ab"));
+    QCOMPARE(budget.count(), 0);
+}
+
+void TestWatchBudget::testHot()
+{
+    Mirall::TemporaryDir tmp;
+    QVERIFY(QDir(tmp.path()).mkdir("busy"));
+    QVERIFY(QDir(tmp.path()).mkdir("quiet"));
+    setMTime(tmp.path() + "/quiet", -60);
+
+    WatchBudget budget;
+    QVERIFY(budget.demote(tmp.path() + "/busy"));
+    QVERIFY(budget.demote(tmp.path() + "/quiet"));
+    // nothing changed yet
+    QVERIFY(budget.hot(60000).isEmpty());
+    setMTime(tmp.path() + "/busy", -60);
+
+    QStringList changed;
+    QStringList gone;
+    checkAll(&budget, &changed, &gone);
+    QCOMPARE(budget.hot(60000), QStringList() << tmp.path() + "/busy");
+    // the window ended before the change
+    QTest::qWait(20);
+    QVERIFY(budget.hot(10).isEmpty());
+}
+
+QTEST_MAIN(TestWatchBudget)
+#include "testwatchbudget.moc"
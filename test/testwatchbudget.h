@@ -0,0 +1,20 @@
+#ifndef MIRALL_TEST_WATCHBUDGET_H
+#define MIRALL_TEST_WATCHBUDGET_H
+
+#include <QtTest/QtTest>
+
+class TestWatchBudget : public QObject
+{
+    Q_OBJECT
+public:
+
+private slots:
+    void testCheck();
+    void testRenameAndRemove();
+    void testHot();
+
+private:
+};
+
+
+#endif